@@ -0,0 +1,97 @@
+#include <vector>
+#include "benchmark.h"
+#include "common.h"
+#include "jake.h"
+
+// Host-to-script call rate through the embedding API: a handler compiled once is called
+// repeatedly with typed arguments, on several independent VMs, with a native that calls
+// back into the script.
+
+static const char* handlerSource = R"(
+func handler(request, weight) {
+    return request * weight + 1;
+}
+
+func forward(request) {
+    return record(request) + handler(request, 2);
+}
+)";
+
+struct Counter {
+    double total = 0;
+};
+
+// Native with user data that calls back into the VM that invoked it
+static Value record(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    if (argc != 1 || !IS_NUMBER(argv[0]))
+        return std::make_shared<ExceptionObj>("Expected a number", ExceptionType::RuntimeError);
+
+    Counter* counter = (Counter*) userData;
+    counter->total += AS_NUMBER(argv[0]);
+
+    Value handler;
+    Value result;
+    Value args[] = {argv[0], NUMBER_VAL(0.5)};
+    interpreter.getGlobal("handler", handler);
+
+    if (interpreter.call(handler, args, 2, result) != InterpreterResult::Success)
+        return std::make_shared<ExceptionObj>(interpreter.lastError(), ExceptionType::RuntimeError);
+
+    return result;
+}
+
+int main(int argc, const char* argv[]) {
+    int calls = argc > 1 ? std::max(1, atoi(argv[1])) : 1000000;
+    int vmCount = argc > 2 ? std::max(1, atoi(argv[2])) : 4;
+
+    std::vector<std::unique_ptr<jake::VM>> vms;
+    std::vector<Counter> counters(vmCount);
+
+    for (int index = 0; index < vmCount; index++) {
+        vms.push_back(std::make_unique<jake::VM>());
+        vms.back()->define("record", &record, &counters[index]);
+
+        if (vms.back()->run(handlerSource) != jake::Result::Success) {
+            printf("[Error] %s\n", vms.back()->error().c_str());
+            return 1;
+        }
+    }
+
+    Timer<std::chrono::microseconds> clock;
+    Value result;
+    double checksum = 0;
+
+    clock.tick();
+    for (int index = 0; index < calls; index++) {
+        jake::VM &vm = *vms[index % vmCount];
+        vm.call(vm.get("handler"), result, index, 3);
+        checksum += AS_NUMBER(result);
+    }
+    clock.tock();
+
+    double seconds = clock.duration().count() / 1e6;
+    printf("%-22s %12.0f calls/s\n", "handler(n, w)", calls / seconds);
+
+    std::vector<Value> forwards;
+    for (auto &vm : vms)
+        forwards.push_back(vm->get("forward"));
+
+    clock.tick();
+    for (int index = 0; index < calls; index++) {
+        jake::VM &vm = *vms[index % vmCount];
+
+        if (vm.call(forwards[index % vmCount], result, index) != jake::Result::Success) {
+            printf("[Error] %s\n", vm.error().c_str());
+            return 1;
+        }
+
+        checksum += AS_NUMBER(result);
+    }
+    clock.tock();
+
+    seconds = clock.duration().count() / 1e6;
+    printf("%-22s %12.0f calls/s\n", "forward(n) + callback", calls / seconds);
+    printf("checksum %g across %d VMs\n", checksum, vmCount);
+
+    return 0;
+}
@@ -0,0 +1,321 @@
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <regex>
+#include <sstream>
+#include <unistd.h>
+#include <fcntl.h>
+#include "benchmark.h"
+#include "common.h"
+#include "interpreter.h"
+
+// Benchmark runner for test/benchmark: runs every script several times in-process,
+// reports median / p95 / standard deviation and compares medians against a saved baseline.
+
+struct BenchOptions {
+    int runs = 5;
+    int warmup = 1;
+    int throughput = 0;
+    double threshold = 5.0;
+    bool showOutput = false;
+    std::string outPath;
+    std::string baselinePath;
+    std::vector<std::filesystem::path> scripts;
+};
+
+struct BenchResult {
+    std::string name;
+    bool failed = false;
+    std::vector<double> samples;
+    double median = 0;
+    double p95 = 0;
+    double mean = 0;
+    double stddev = 0;
+    double min = 0;
+};
+
+static std::string readFile(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+// Scripts print their own results, which would swamp the report
+class StdoutSilencer {
+public:
+    StdoutSilencer(bool enabled) {
+        if (!enabled) return;
+
+        fflush(stdout);
+        std::cout.flush();
+        savedFd = dup(STDOUT_FILENO);
+        int nullFd = open("/dev/null", O_WRONLY);
+        dup2(nullFd, STDOUT_FILENO);
+        close(nullFd);
+    }
+
+    ~StdoutSilencer() {
+        if (savedFd == -1) return;
+
+        fflush(stdout);
+        std::cout.flush();
+        dup2(savedFd, STDOUT_FILENO);
+        close(savedFd);
+    }
+
+private:
+    int savedFd = -1;
+};
+
+static bool runOnce(const std::string &source, bool showOutput, double &milliseconds) {
+    // A fresh interpreter per run so globals from the previous run don't leak in
+    auto interpreter = std::make_unique<Interpreter>();
+    Timer<std::chrono::microseconds> clock;
+    InterpreterResult result;
+
+    {
+        StdoutSilencer silencer(!showOutput);
+
+        clock.tick();
+        result = interpreter->interpret(source.c_str());
+        clock.tock();
+    }
+
+    milliseconds = clock.duration().count() / 1000.0;
+    return result == InterpreterResult::Success;
+}
+
+// Runs the script `count` times back to back, either constructing an interpreter per run or
+// reusing one through reset(), and returns runs per second
+static double measureThroughput(const std::string &source, int count, bool reuse, bool showOutput) {
+    std::unique_ptr<Interpreter> interpreter = std::make_unique<Interpreter>();
+    StdoutSilencer silencer(!showOutput);
+    Timer<std::chrono::microseconds> clock;
+
+    clock.tick();
+    for (int run = 0; run < count; run++) {
+        if (reuse) {
+            interpreter->reset();
+        } else {
+            interpreter = std::make_unique<Interpreter>();
+        }
+
+        if (interpreter->interpret(source.c_str()) != InterpreterResult::Success)
+            return -1;
+    }
+    clock.tock();
+
+    return count / (clock.duration().count() / 1e6);
+}
+
+static int runThroughput(const BenchOptions &options) {
+    int failures = 0;
+
+    printf("%-18s %14s %14s %10s\n", "benchmark", "fresh runs/s", "reset runs/s", "speedup");
+
+    for (auto &script : options.scripts) {
+        std::string name = script.stem().string();
+        std::string source = readFile(script);
+
+        double fresh = measureThroughput(source, options.throughput, false, options.showOutput);
+        double reused = measureThroughput(source, options.throughput, true, options.showOutput);
+
+        if (fresh < 0 || reused < 0) {
+            printf("%-18s %14s\n", name.c_str(), "FAILED");
+            failures++;
+            continue;
+        }
+
+        printf("%-18s %14.1f %14.1f %9.2fx\n", name.c_str(), fresh, reused, reused / fresh);
+    }
+
+    return failures ? 1 : 0;
+}
+
+static void computeStats(BenchResult &result) {
+    std::vector<double> sorted = result.samples;
+    std::sort(sorted.begin(), sorted.end());
+
+    size_t count = sorted.size();
+    result.min = sorted.front();
+    result.median = count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    result.p95 = sorted[std::min(count - 1, (size_t) std::ceil(0.95 * count) - 1)];
+
+    double sum = 0;
+    for (double sample : sorted) sum += sample;
+    result.mean = sum / count;
+
+    double squares = 0;
+    for (double sample : sorted) squares += (sample - result.mean) * (sample - result.mean);
+    result.stddev = count > 1 ? std::sqrt(squares / (count - 1)) : 0;
+}
+
+static BenchResult runBenchmark(const std::filesystem::path &path, const BenchOptions &options) {
+    BenchResult result;
+    result.name = path.stem().string();
+
+    std::string source = readFile(path);
+    double milliseconds;
+
+    for (int run = 0; run < options.warmup + options.runs; run++) {
+        if (!runOnce(source, options.showOutput, milliseconds)) {
+            result.failed = true;
+            return result;
+        }
+
+        if (run >= options.warmup)
+            result.samples.push_back(milliseconds);
+    }
+
+    computeStats(result);
+    return result;
+}
+
+static bool writeResults(const std::string &path, const BenchOptions &options, const std::vector<BenchResult> &results) {
+    std::ofstream file(path);
+
+    if (!file.is_open())
+        return false;
+
+    file << "{\n  \"runs\": " << options.runs << ",\n  \"warmup\": " << options.warmup << ",\n  \"benchmarks\": [";
+
+    for (size_t index = 0; index < results.size(); index++) {
+        const BenchResult &result = results[index];
+
+        file << (index ? ",\n" : "\n") << "    {\"name\": \"" << result.name << "\"";
+
+        if (result.failed) {
+            file << ", \"failed\": true}";
+            continue;
+        }
+
+        file << formatStr(", \"median_ms\": %.3f, \"p95_ms\": %.3f, \"mean_ms\": %.3f, \"stddev_ms\": %.3f, \"min_ms\": %.3f, \"samples_ms\": [",
+            result.median, result.p95, result.mean, result.stddev, result.min);
+
+        for (size_t sample = 0; sample < result.samples.size(); sample++)
+            file << (sample ? ", " : "") << formatStr("%.3f", result.samples[sample]);
+
+        file << "]}";
+    }
+
+    file << "\n  ]\n}\n";
+    return true;
+}
+
+// Reads the medians back out of a file written by writeResults
+static std::map<std::string, double> readBaseline(const std::string &path) {
+    std::map<std::string, double> medians;
+    std::string json = readFile(path);
+
+    std::regex entry("\"name\":\\s*\"([^\"]*)\",\\s*\"median_ms\":\\s*([-0-9.eE+]+)");
+
+    for (auto match = std::sregex_iterator(json.begin(), json.end(), entry); match != std::sregex_iterator(); match++)
+        medians[(*match)[1]] = std::stod((*match)[2]);
+
+    return medians;
+}
+
+static void printUsage() {
+    print("Usage: jake-bench [options] [scripts...]");
+    print("    --runs N           Measured runs per script (default 5)");
+    print("    --warmup N         Unmeasured runs before measuring (default 1)");
+    print("    --out PATH         Write results as JSON");
+    print("    --baseline PATH    Compare medians against a previous --out file");
+    print("    --threshold PCT    Allowed median slowdown against the baseline (default 5)");
+    print("    --show-output      Don't silence script output");
+    print("    --throughput N     Instead of timing, run each script N times with a fresh");
+    print("                       interpreter and N times reusing one through reset()");
+}
+
+int main(int argc, const char* argv[]) {
+    BenchOptions options;
+
+    for (int index = 1; index < argc; index++) {
+        std::string arg = argv[index];
+        bool hasValue = index + 1 < argc;
+
+        if (arg == "--runs" && hasValue) {
+            options.runs = std::max(1, atoi(argv[++index]));
+        } else if (arg == "--warmup" && hasValue) {
+            options.warmup = std::max(0, atoi(argv[++index]));
+        } else if (arg == "--out" && hasValue) {
+            options.outPath = argv[++index];
+        } else if (arg == "--baseline" && hasValue) {
+            options.baselinePath = argv[++index];
+        } else if (arg == "--threshold" && hasValue) {
+            options.threshold = atof(argv[++index]);
+        } else if (arg == "--throughput" && hasValue) {
+            options.throughput = std::max(1, atoi(argv[++index]));
+        } else if (arg == "--show-output") {
+            options.showOutput = true;
+        } else if (arg == "--help") {
+            printUsage();
+            return 0;
+        } else if (arg.rfind("--", 0) == 0) {
+            printUsage();
+            return 1;
+        } else {
+            options.scripts.push_back(arg);
+        }
+    }
+
+    if (options.scripts.empty()) {
+        for (auto &entry : std::filesystem::directory_iterator(JAKE_SOURCE_DIR "/test/benchmark")) {
+            if (entry.path().extension() == ".jake")
+                options.scripts.push_back(entry.path());
+        }
+        std::sort(options.scripts.begin(), options.scripts.end());
+    }
+
+    if (options.throughput)
+        return runThroughput(options);
+
+    std::map<std::string, double> baseline;
+    if (!options.baselinePath.empty())
+        baseline = readBaseline(options.baselinePath);
+
+    std::vector<BenchResult> results;
+    int failures = 0;
+    int regressions = 0;
+
+    printf("%-18s %12s %12s %12s %12s\n", "benchmark", "median ms", "p95 ms", "stddev ms", "vs base");
+
+    for (auto &script : options.scripts) {
+        BenchResult result = runBenchmark(script, options);
+        results.push_back(result);
+
+        if (result.failed) {
+            printf("%-18s %12s\n", result.name.c_str(), "FAILED");
+            failures++;
+            continue;
+        }
+
+        std::string comparison = "-";
+        auto base = baseline.find(result.name);
+
+        if (base != baseline.end() && base->second > 0) {
+            double change = (result.median / base->second - 1) * 100;
+            comparison = formatStr("%+.1f%%", change);
+
+            if (change > options.threshold) {
+                comparison += " REGRESSION";
+                regressions++;
+            }
+        }
+
+        printf("%-18s %12.3f %12.3f %12.3f %12s\n", result.name.c_str(), result.median, result.p95, result.stddev, comparison.c_str());
+    }
+
+    if (!options.outPath.empty() && !writeResults(options.outPath, options, results)) {
+        printf("[Error] Failed to write %s\n", options.outPath.c_str());
+        return 1;
+    }
+
+    if (regressions)
+        printf("%d benchmark(s) regressed by more than %.1f%%\n", regressions, options.threshold);
+
+    return failures || regressions ? 1 : 0;
+}
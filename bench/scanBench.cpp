@@ -0,0 +1,99 @@
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "benchmark.h"
+#include "common.h"
+#include "scanner.h"
+
+// Scanner micro-benchmark: replicates the given sources (test/benchmark by default)
+// into one large buffer and reports scanning throughput alone, without the parser.
+
+static std::string readFile(const std::filesystem::path &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+static size_t scanAll(const char* source) {
+    Scanner scanner = Scanner(source);
+    size_t tokenCount = 0;
+
+    for (;;) {
+        Token token = scanner.scanToken();
+        tokenCount++;
+
+        if (token.type == TokenType::EndOfFile)
+            break;
+    }
+
+    return tokenCount;
+}
+
+int main(int argc, const char* argv[]) {
+    int iterations = 10;
+    size_t minBytes = 16 << 20;
+    std::vector<std::filesystem::path> paths;
+
+    for (int index = 1; index < argc; index++) {
+        std::string arg = argv[index];
+
+        if (arg == "--iterations" && index + 1 < argc) {
+            iterations = std::max(1, atoi(argv[++index]));
+        } else if (arg == "--size-mb" && index + 1 < argc) {
+            minBytes = (size_t) std::max(1, atoi(argv[++index])) << 20;
+        } else if (arg == "--help") {
+            print("Usage: jake-scanbench [--iterations N] [--size-mb MB] [files...]");
+            return 0;
+        } else {
+            paths.push_back(arg);
+        }
+    }
+
+    if (paths.empty()) {
+        for (auto &entry : std::filesystem::directory_iterator(JAKE_SOURCE_DIR "/test/benchmark")) {
+            if (entry.path().extension() == ".jake")
+                paths.push_back(entry.path());
+        }
+        std::sort(paths.begin(), paths.end());
+    }
+
+    std::string corpus;
+    for (auto &path : paths) {
+        corpus += readFile(path);
+        corpus += '\n';
+    }
+
+    if (corpus.empty()) {
+        print("[Error] No source to scan");
+        return 1;
+    }
+
+    std::string source;
+    source.reserve(minBytes + corpus.size());
+    while (source.size() < minBytes)
+        source += corpus;
+
+    std::vector<double> seconds;
+    size_t tokenCount = 0;
+
+    Timer<std::chrono::nanoseconds> clock;
+    for (int iteration = 0; iteration < iterations; iteration++) {
+        clock.tick();
+        tokenCount = scanAll(source.c_str());
+        clock.tock();
+
+        seconds.push_back(clock.duration().count() / 1e9);
+    }
+
+    std::sort(seconds.begin(), seconds.end());
+    double median = seconds[seconds.size() / 2];
+    double megabytes = source.size() / (1024.0 * 1024.0);
+
+    printf("scanned %.1f MB (%zu tokens) x %d\n", megabytes, tokenCount, iterations);
+    printf("median %.3f ms  best %.3f ms\n", median * 1e3, seconds.front() * 1e3);
+    printf("%.1f MB/s  %.1f Mtokens/s\n", megabytes / median, tokenCount / median / 1e6);
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include <fcntl.h>
+#include "benchmark.h"
+#include "common.h"
+#include "jake.h"
+
+// Thread scaling: the script is compiled and frozen once, then run on 1, 2, 4 ... threads,
+// each thread with its own VM. Reports total runs per second and the scaling efficiency
+// against a single thread.
+
+static std::string readFile(const char* path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+}
+
+static double measure(jake::Script script, int threadCount, int runsPerThread, bool &failed) {
+    std::vector<std::thread> threads;
+    std::vector<int> failures(threadCount, 0);
+    Timer<std::chrono::microseconds> clock;
+
+    clock.tick();
+    for (int index = 0; index < threadCount; index++) {
+        threads.emplace_back([&, index]() {
+            jake::VM vm;
+
+            for (int run = 0; run < runsPerThread; run++) {
+                vm.reset();
+                if (vm.run(script) != jake::Result::Success)
+                    failures[index]++;
+            }
+        });
+    }
+
+    for (std::thread &thread : threads)
+        thread.join();
+    clock.tock();
+
+    for (int count : failures)
+        failed |= count > 0;
+
+    return threadCount * runsPerThread / (clock.duration().count() / 1e6);
+}
+
+int main(int argc, const char* argv[]) {
+    const char* path = JAKE_SOURCE_DIR "/test/benchmark/fib.jake";
+    int runs = 1;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (int index = 1; index < argc; index++) {
+        std::string arg = argv[index];
+
+        if (arg == "--runs" && index + 1 < argc) {
+            runs = std::max(1, atoi(argv[++index]));
+        } else if (arg == "--threads" && index + 1 < argc) {
+            maxThreads = std::max(1, atoi(argv[++index]));
+        } else if (arg.rfind("--", 0) == 0) {
+            print("Usage: jake-threadbench [--runs N] [--threads MAX] [script]");
+            return arg == "--help" ? 0 : 1;
+        } else {
+            path = argv[index];
+        }
+    }
+
+    std::string source = readFile(path);
+    jake::VM compiler;
+    jake::Script script = compiler.compile(source);
+
+    if (!script.freeze()) {
+        printf("[Error] Failed to compile %s\n", path);
+        return 1;
+    }
+
+    // Scripts print their results, keep them out of the table
+    fflush(stdout);
+    int savedFd = dup(STDOUT_FILENO);
+    int nullFd = open("/dev/null", O_WRONLY);
+
+    printf("%-8s %12s %12s\n", "threads", "runs/s", "efficiency");
+    fflush(stdout);
+
+    double single = 0;
+    bool failed = false;
+
+    for (int threadCount = 1; threadCount <= maxThreads; threadCount = threadCount < maxThreads ? std::min(threadCount * 2, maxThreads) : maxThreads + 1) {
+        dup2(nullFd, STDOUT_FILENO);
+        double rate = measure(script, threadCount, runs, failed);
+        fflush(stdout);
+        dup2(savedFd, STDOUT_FILENO);
+
+        if (threadCount == 1)
+            single = rate;
+
+        printf("%-8d %12.2f %11.1f%%\n", threadCount, rate, rate / (single * threadCount) * 100);
+        fflush(stdout);
+    }
+
+    close(nullFd);
+    close(savedFd);
+
+    if (failed)
+        printf("[Error] Some runs failed\n");
+
+    return failed ? 1 : 0;
+}
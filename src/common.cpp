@@ -1,3 +1,5 @@
+#include <charconv>
+#include <cstdlib>
 #include <stdarg.h>
 #include "common.h"
 
@@ -13,4 +15,30 @@ std::string formatStr(const char* fmt, ...) {
     va_end(args);
 
     return std::string(buffer);
-}
\ No newline at end of file
+}
+
+bool parseNumber(std::string_view text, double &value) {
+    auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; };
+
+    while (!text.empty() && isSpace(text.front())) text.remove_prefix(1);
+    while (!text.empty() && isSpace(text.back())) text.remove_suffix(1);
+
+    // from_chars takes a minus sign but not a plus
+    if (text.size() > 1 && text.front() == '+' && text[1] != '-')
+        text.remove_prefix(1);
+
+    if (text.empty())
+        return false;
+
+    auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+
+    if (end != text.data() + text.size())
+        return false;
+
+    // Too large or too small for a double, from_chars leaves value alone where strtod rounds
+    // to infinity or zero
+    if (error == std::errc::result_out_of_range)
+        value = strtod(std::string(text).c_str(), nullptr);
+
+    return error == std::errc() || error == std::errc::result_out_of_range;
+}
@@ -5,18 +5,34 @@
 #include "value.h"
 #include "print.h"
 
-Parser::Parser(const char* source) :  source(source) {
-    scanner = Scanner(source);
+Parser::Parser(const char* source, bool lazy) : lazy(lazy), source(source) {
+    if (lazy) {
+        sharedSource = std::make_shared<const std::string>(source);
+        this->source = sharedSource->c_str();
+    }
+
+    scanner = Scanner(this->source);
+    currentToken = previousToken = Token{TokenType::EndOfFile, "", 1};
     canAssign = false;
     hadError = false;
-    currentLineNumber = 0;
 }
 
-FunctionValue Parser::compile() {
+// Parses more of a lazy parser's source, functions in it are compiled lazily as well
+Parser::Parser(std::shared_ptr<const std::string> source) : Parser("", false) {
+    lazy = true;
+    sharedSource = source;
+    this->source = sharedSource->c_str();
+    scanner = Scanner(this->source);
+}
+
+FunctionValue Parser::compile(bool echoResult) {
+    // Compiled code outlives runs and is shared between threads once frozen, its constants
+    // aren't charged to any heap
+    HeapScope uncharged(nullptr);
     Compiler startingCompiler = Compiler(FunctionType::Script);
 
+    this->echoResult = echoResult;
     hadError = false;
-    currentLineNumber = 1;
     compiler = &startingCompiler;
 
     advance();
@@ -29,6 +45,47 @@ FunctionValue Parser::compile() {
     return hadError ? nullptr : function;
 }
 
+bool Parser::compileLazy(FunctionObj* function) {
+    LazyFunction &stub = *function->lazy;
+
+    ClassCompiler classCompiler = ClassCompiler{nullptr, stub.hasSuperClass};
+    if (stub.inClass)
+        currentClass = &classCompiler;
+
+    Compiler funcCompiler = Compiler(stub.type);
+    funcCompiler.capturedNames = &stub.capturedNames;
+    funcCompiler.function->name = function->name;
+    funcCompiler.function->upValueCount = function->upValueCount;
+    compiler = &funcCompiler;
+
+    hadError = false;
+    scanner.seek(source + stub.offset, stub.line);
+    advance();
+
+    functionBody();
+    FunctionValue compiled = endCompiliation();
+
+    if (hadError)
+        return false;
+
+    function->chunk = std::move(compiled->chunk);
+    return true;
+}
+
+bool compileLazyFunction(FunctionObj* function, std::string &error) {
+    // The parser points into the source, keep it alive past the stub being cleared
+    std::shared_ptr<LazyFunction> stub = function->lazy;
+    Parser parser = Parser(stub->source);
+    HeapScope uncharged(nullptr);
+    parser.diagnostics = &error;
+
+    if (!parser.compileLazy(function))
+        return false;
+
+    function->lazy = nullptr;
+    return true;
+}
+
 void Parser::advance() {
     if (hadError) return;
 
@@ -67,10 +124,12 @@ bool Parser::match(TokenType type) {
 void Parser::errorAt(Token& token, std::string msg, bool addValue) {
     if (scanner.handledError) return;
 
-    if (addValue) {
-        printError(ExceptionType::SyntaxError, msg, token.line, std::string(token.source).c_str());
+    std::string value = addValue ? std::string(token.source) : "";
+
+    if (diagnostics != nullptr) {
+        *diagnostics = value.size() ? formatStr("%s '%s' on line %d", msg.c_str(), value.c_str(), token.line) : formatStr("%s on line %d", msg.c_str(), token.line);
     } else {
-        printError(ExceptionType::SyntaxError, msg, token.line, "");
+        printError(ExceptionType::SyntaxError, msg, token.line, value);
     }
 
     hadError = true;
@@ -111,9 +170,11 @@ void Parser::emitByte(u8 byte) {
     
     currentChunk->bytecode.push_back(byte);    
 
-    if (scanner.lineNumber != currentLineNumber) {
-        currentChunk->lineNumbers[scanner.lineNumber] = (signed) currentChunk->bytecode.size() - 1;
-        currentLineNumber = scanner.lineNumber;
+    // Line numbers are tracked per chunk, nested functions interleave their lines with the enclosing one
+    int lineNumber = previousToken.line;
+
+    if (currentChunk->lineNumbers.empty() || currentChunk->lineNumbers.rbegin()->first < lineNumber) {
+        currentChunk->lineNumbers[lineNumber] = (signed) currentChunk->bytecode.size() - 1;
     }
 
 }
@@ -209,10 +270,16 @@ ParseRule Parser::getRule(TokenType type) {
             return ParseRule {NULL, &Parser::binary, Precedence::Factor};
         case TokenType::Dot:
             return ParseRule {NULL, &Parser::dot, Precedence::Call};
+        case TokenType::LeftBracket:
+            return ParseRule {&Parser::list, &Parser::subscript, Precedence::Call};
+        case TokenType::LeftBrace:
+            return ParseRule {&Parser::map, NULL, Precedence::None};
         case TokenType::This:
             return ParseRule {&Parser::__this__, NULL, Precedence::None};
         case TokenType::Super:
             return ParseRule {&Parser::__super__, NULL, Precedence::None};
+        case TokenType::Yield:
+            return ParseRule {&Parser::__yield__, NULL, Precedence::None};
 
         case TokenType::EqualEqual:
         case TokenType::BangEqual:
@@ -284,7 +351,17 @@ int Parser::findLocal(Compiler* comp, Token* name) {
 }
 
 int Parser::findUpValue(Compiler* comp, Token* name) {
-    if (comp->enclosing == NULL) return -1;
+    if (comp->enclosing == NULL) {
+        if (comp->capturedNames == nullptr)
+            return -1;
+
+        for (int index = 0; index < (signed) comp->capturedNames->size(); index++) {
+            if (identifiersEqual(name, (Token*) &(*comp->capturedNames)[index]))
+                return index;
+        }
+
+        return -1;
+    }
 
     int local = findLocal(comp->enclosing, name);
     if (local != -1) {
@@ -367,6 +444,13 @@ void Parser::namedVariable(Token name) {
             expression();
             emitByte(setOp);
             emitByte((u8) arg);
+        } else if (match(TokenType::PlusEqual)) {
+            // Appends to the variable in place, so building a string with += in a loop
+            // doesn't copy the whole string every time
+            expression();
+            emitByte(OpAddAssign);
+            emitByte(setOp);
+            emitByte((u8) arg);
         } else {
             TokenType type = currentToken.type;
             advance();
@@ -459,14 +543,10 @@ void Parser::__super__() {
 }
 
 void Parser::number() {
-    double value;
+    double value = 0;
 
-    if (previousToken.source.front() == '.') {
-        std::string literal = std::string(previousToken.source);
-        value = std::stod("0." + literal);
-    } else {
-        value = std::stod(std::string(previousToken.source));
-    }
+    // The scanner only makes number tokens from digits and a dot, this can't fail
+    parseNumber(previousToken.source, value);
 
     emitConstant(NUMBER_VAL(value));
 }
@@ -479,6 +559,23 @@ void Parser::string() {
     emitConstant(std::string(previousToken.source.data() + 1, previousToken.source.size() - 2));
 }
 
+// yield suspends the coroutine running it and evaluates to the value it's resumed with
+void Parser::__yield__() {
+    if (compiler->type == FunctionType::Script) {
+        error("Cannot yield from top level of code");
+        return;
+    }
+
+    if (check(TokenType::Semicolon) || check(TokenType::RightParen) || check(TokenType::Comma) || check(TokenType::RightBracket) ||
+        check(TokenType::RightBrace) || check(TokenType::Colon)) {
+        emitByte(OpNone);
+    } else {
+        parsePrecedence(Precedence::Assignment);
+    }
+
+    emitByte(OpYield);
+}
+
 void Parser::literal() {
     switch (previousToken.type) {
         case TokenType::True:
@@ -506,6 +603,69 @@ void Parser::call() {
     emitByte(argc);
 }
 
+void Parser::list() {
+    u8 count = 0;
+
+    if (!check(TokenType::RightBracket)) {
+        do {
+            // Allow a trailing comma
+            if (check(TokenType::RightBracket))
+                break;
+
+            expression();
+
+            if (count == UINT8_MAX) {
+                error(formatStr("Too many elements in a list literal (max: %d)", UINT8_MAX));
+            }
+
+            count++;
+        } while (match(TokenType::Comma));
+    }
+
+    consume(TokenType::RightBracket, "Expected ']' after list elements");
+    emitByte(OpBuildList);
+    emitByte(count);
+}
+
+void Parser::map() {
+    u8 count = 0;
+
+    if (!check(TokenType::RightBrace)) {
+        do {
+            if (check(TokenType::RightBrace))
+                break;
+
+            expression();
+            consume(TokenType::Colon, "Expected ':' after map key");
+            expression();
+
+            if (count == UINT8_MAX) {
+                error(formatStr("Too many entries in a map literal (max: %d)", UINT8_MAX));
+            }
+
+            count++;
+        } while (match(TokenType::Comma));
+    }
+
+    consume(TokenType::RightBrace, "Expected '}' after map entries");
+    emitByte(OpBuildMap);
+    emitByte(count);
+}
+
+void Parser::subscript() {
+    bool assign = canAssign;
+
+    expression();
+    consume(TokenType::RightBracket, "Expected ']' after index");
+
+    if (assign && match(TokenType::Equal)) {
+        expression();
+        emitByte(OpIndexSet);
+    } else {
+        emitByte(OpIndexGet);
+    }
+}
+
 void Parser::dot() {
     consume(TokenType::Identifier, "Expected identifier after '.'");
 
@@ -647,11 +807,29 @@ void Parser::block() {
 }
 
 void Parser::function(FunctionType type) {
+    if (lazy) {
+        lazyFunction(type);
+        return;
+    }
+
     Compiler funcCompiler = Compiler(type);
     funcCompiler.enclosing = compiler;
     funcCompiler.function->name = std::string(previousToken.source);
     compiler = &funcCompiler;
 
+    functionBody();
+
+    FunctionValue function = endCompiliation();
+    emitClosure(function, funcCompiler);
+}
+
+// Parameters and body of the function being compiled, from its '('
+void Parser::functionBody() {
+    parameters();
+    block();
+}
+
+void Parser::parameters() {
     beginScope(); 
     consume(TokenType::LeftParen, "Expected '(' after function name");
     
@@ -672,11 +850,78 @@ void Parser::function(FunctionType type) {
     
     if (!check(TokenType::LeftBrace))
         errorAt(currentToken, "Expected '{' before function body");
+}
 
-    block();
+// Declares the parameters but only skips over the body, collecting the names it mentions so
+// the closure can capture them now. The body is compiled by compileLazyFunction on first call.
+void Parser::lazyFunction(FunctionType type) {
+    Compiler funcCompiler = Compiler(type);
+    funcCompiler.enclosing = compiler;
+    funcCompiler.function->name = std::string(previousToken.source);
+    compiler = &funcCompiler;
 
-    FunctionValue function = endCompiliation();
+    size_t offset = currentToken.source.data() - source;
+    int line = currentToken.line;
+
+    parameters();
+
+    std::vector<Token> names;
+    int depth = 0;
+
+    while (!isFinished()) {
+        if (check(TokenType::LeftBrace)) {
+            depth++;
+        } else if (check(TokenType::RightBrace)) {
+            depth--;
+        } else if (check(TokenType::Identifier) && previousToken.type != TokenType::Dot) {
+            names.push_back(currentToken);
+        } else if (check(TokenType::This)) {
+            names.push_back(Token{TokenType::Identifier, "this"});
+        } else if (check(TokenType::Super)) {
+            names.push_back(Token{TokenType::Identifier, "this"});
+            names.push_back(Token{TokenType::Identifier, "super"});
+        }
+
+        advance();
+
+        if (depth == 0)
+            break;
+    }
+
+    if (depth != 0)
+        errorAt(currentToken, "Expected '}' after block");
+
+    // Resolved like the body would resolve them, names that aren't local anywhere are globals
+    std::vector<Token> captured;
+
+    for (Token &name : names) {
+        if (findLocal(compiler, &name) != -1)
+            continue;
+
+        int upValue = findUpValue(compiler, &name);
+
+        if (upValue == -1)
+            continue;
+
+        if (upValue >= (signed) captured.size())
+            captured.resize(upValue + 1);
 
+        captured[upValue] = name;
+    }
+
+    compiler = compiler->enclosing;
+
+    FunctionValue function = funcCompiler.function;
+    function->lazy = std::make_shared<LazyFunction>(LazyFunction{
+        sharedSource, offset, line, type,
+        currentClass != NULL, currentClass != NULL && currentClass->hasSuperClass,
+        std::move(captured)
+    });
+
+    emitClosure(function, funcCompiler);
+}
+
+void Parser::emitClosure(FunctionValue function, Compiler &funcCompiler) {
     emitByte(OpClosure);
     emitByte(makeConstant(function));
 
@@ -699,8 +944,11 @@ void Parser::method() {
 
 void Parser::expressionStatement() {
     expression();
-    emitByte(OpPop);
     consume(TokenType::Semicolon, "Expected ';' after expression");
+
+    // The REPL shows the value of an expression typed on its own
+    bool echo = echoResult && compiler->type == FunctionType::Script && compiler->scopeDepth == 0 && isFinished();
+    emitByte(echo ? OpPrint : OpPop);
 }
 
 void Parser::printStatement() {
@@ -710,6 +958,55 @@ void Parser::printStatement() {
     consume(TokenType::Semicolon, "Expected ';' after print statement");
 }
 
+// The try block compiles to nothing but its range in the chunk's handler table, entering it
+// costs nothing. The catch block is only reached by the interpreter unwinding to it, with the
+// thrown value on the stack where the catch variable's slot goes.
+void Parser::tryStatement() {
+    advance();
+
+    if (!check(TokenType::LeftBrace))
+        errorAt(currentToken, "Expected '{' after 'try'");
+
+    ExceptionHandler handler;
+    handler.stackDepth = compiler->localCount + compiler->localStackOffset;
+    handler.start = (signed) getChunk()->bytecode.size();
+
+    beginScope();
+    block();
+    endScope();
+
+    handler.end = (signed) getChunk()->bytecode.size();
+    int skipCatch = emitJump(OpJump);
+    handler.handler = (signed) getChunk()->bytecode.size();
+
+    consume(TokenType::Catch, "Expected 'catch' after try block");
+    consume(TokenType::LeftParen, "Expected '(' after 'catch'");
+    consume(TokenType::Identifier, "Expected a name for the caught value");
+
+    beginScope();
+    declareVariable();
+    markInitialized();
+
+    consume(TokenType::RightParen, "Expected ')' after the caught value's name");
+
+    if (!check(TokenType::LeftBrace))
+        errorAt(currentToken, "Expected '{' after catch");
+
+    block();
+    endScope();
+    patchJump(skipCatch);
+
+    // Added after any try blocks nested inside, so the innermost one is found first
+    getChunk()->handlers.push_back(handler);
+}
+
+void Parser::throwStatement() {
+    advance();
+    expression();
+    emitByte(OpThrow);
+    consume(TokenType::Semicolon, "Expected ';' after thrown value");
+}
+
 void Parser::returnStatement() {
     if (compiler->type == FunctionType::Script) {
         error("Cannot return from top level of code");
@@ -836,6 +1133,14 @@ void Parser::statement() {
         case TokenType::Print:
             printStatement();
             break;
+
+        case TokenType::Try:
+            tryStatement();
+            break;
+
+        case TokenType::Throw:
+            throwStatement();
+            break;
         
         case TokenType::LeftBrace:
             beginScope();
@@ -875,6 +1180,19 @@ void Parser::funcDeclaration() {
     defineVariable(global);
 }
 
+// import name; runs name.jake from the module search path the first time and binds the
+// module to name, like a var declaration would
+void Parser::importDeclaration() {
+    advance();
+    u8 global = parseVariableName("Expected module name");
+
+    emitByte(OpImport);
+    emitByte(global);
+
+    consume(TokenType::Semicolon, "Expected ';' after import");
+    defineVariable(global);
+}
+
 void Parser::classDeclaration() {
     advance();
     consume(TokenType::Identifier, "Expected class name");
@@ -947,6 +1265,10 @@ void Parser::declaration() {
             classDeclaration();
             break;
 
+        case TokenType::Import:
+            importDeclaration();
+            break;
+
         default:
             statement();
             break;
@@ -0,0 +1,586 @@
+#include <unordered_set>
+#include "concurrency.h"
+#include "interpreter.h"
+#include "map.h"
+#include "typedArray.h"
+#include "module.h"
+#include "profiler.h"
+
+// Transfer
+
+template <typename T> struct IsObject : std::false_type {};
+template <typename T> struct IsObject<std::shared_ptr<T>> : std::true_type {};
+
+static const char* heapQuotaError = "Heap quota exceeded";
+
+static const void* objectKey(const Value &value) {
+    return std::visit([](auto &object) -> const void* {
+        if constexpr (IsObject<std::decay_t<decltype(object)>>::value)
+            return object.get();
+        else
+            return nullptr;
+    }, (const ValueVariant&) value);
+}
+
+template <typename T, typename... Args>
+static std::shared_ptr<T> allocateIn(HeapAccount* account, Args&&... args) {
+    return std::allocate_shared<T>(AccountedAllocator<T>(account), std::forward<Args>(args)...);
+}
+
+// A copy that would take the destination over its quota fails before anything is allocated
+// for it, the receiving interpreter isn't stopped over a value it never got
+static bool fits(HeapAccount* account, size_t size) {
+    return account == nullptr || account->canAllocate(size);
+}
+
+static Value quotaExceeded() {
+    return std::make_shared<ExceptionObj>(heapQuotaError, ExceptionType::RuntimeError);
+}
+
+static UpValuePtrValue transferUpValue(UpValuePtrValue upValue, TransferMemo &memo, HeapAccount* account) {
+    auto copied = memo.find(upValue.get());
+    if (copied != memo.end())
+        return AS_UPVALUE(copied->second);
+
+    // Open upvalues still point into the sending thread's stack, the copy is always closed
+    UpValuePtrValue copy = allocateIn<UpValueObj>(account);
+    copy->location = &copy->closed;
+    memo[upValue.get()] = copy;
+
+    copy->closed = transferValue(*upValue->location, memo, account);
+    return copy;
+}
+
+Value transferValue(const Value &value, TransferMemo &memo, HeapAccount* account) {
+    // Strings copied below are charged to the destination too
+    HeapScope charged(account);
+
+    switch (value.type()) {
+        case ValueType::None:
+        case ValueType::Number:
+        case ValueType::Boolean:
+        case ValueType::NativeFunc:
+        case ValueType::Channel:
+            return value;
+
+        case ValueType::String:
+            if (!fits(account, AS_STRING(value).size()))
+                return quotaExceeded();
+            return value;
+
+        case ValueType::Function: {
+            if (!AS_FUNCTION(value)->freeze())
+                return std::make_shared<ExceptionObj>("Function can't be shared between threads", ExceptionType::RuntimeError);
+            return value;
+        }
+
+        case ValueType::Thread:
+            return std::make_shared<ExceptionObj>("Threads can't be sent to another thread", ExceptionType::RuntimeError);
+
+        // The parent is shared without locking, the other thread gets its own copy of the text
+        case ValueType::StringSlice:
+            if (!fits(account, textOf(value).size()))
+                return quotaExceeded();
+            return StringValue(textOf(value));
+
+        default:
+            break;
+    }
+
+    const void* key = objectKey(value);
+    auto copied = memo.find(key);
+    if (copied != memo.end())
+        return copied->second;
+
+    switch (value.type()) {
+        case ValueType::UpValuePtr:
+            return transferUpValue(AS_UPVALUE(value), memo, account);
+
+        case ValueType::Closure: {
+            ClosureValue closure = AS_CLOSURE(value);
+            Value function = transferValue(closure->function, memo, account);
+            if (IS_EXCEPTION(function))
+                return function;
+
+            ClosureValue copy = allocateIn<ClosureObj>(account, closure->function);
+            memo[key] = copy;
+
+            for (UpValuePtrValue &upValue : closure->upValues)
+                copy->upValues.push_back(transferUpValue(upValue, memo, account));
+
+            if (closure->module != nullptr) {
+                Value module = transferValue(closure->module, memo, account);
+                if (IS_EXCEPTION(module))
+                    return module;
+                copy->module = AS_MODULE(module);
+            }
+
+            return copy;
+        }
+
+        // The thread gets its own copy of the module's globals, like it does of the main ones
+        case ValueType::Module: {
+            ModuleValue module = AS_MODULE(value);
+            ModuleValue copy = allocateIn<ModuleObj>(account, module->name, module->path);
+            memo[key] = copy;
+
+            for (auto &[name, global] : module->globals) {
+                Value transferred = transferValue(global, memo, account);
+                if (!IS_EXCEPTION(transferred))
+                    copy->globals[name] = transferred;
+            }
+
+            return copy;
+        }
+
+        case ValueType::Exception: {
+            ExceptionValue exception = AS_EXCEPTION(value);
+            return memo[key] = allocateIn<ExceptionObj>(account, exception->msg, exception->type);
+        }
+
+        case ValueType::Class: {
+            ClassValue klass = AS_CLASS(value);
+            ClassValue copy = allocateIn<ClassObj>(account, klass->name);
+            memo[key] = copy;
+
+            for (auto &[name, method] : klass->methods) {
+                Value transferred = transferValue(method, memo, account);
+                if (IS_EXCEPTION(transferred))
+                    return transferred;
+                copy->methods[name] = transferred;
+            }
+
+            return copy;
+        }
+
+        case ValueType::Instance: {
+            InstanceValue instance = AS_INSTANCE(value);
+            Value klass = transferValue(instance->klass, memo, account);
+            if (IS_EXCEPTION(klass))
+                return klass;
+
+            InstanceValue copy = allocateIn<InstanceObj>(account, AS_CLASS(klass));
+            memo[key] = copy;
+
+            for (auto &[name, field] : instance->fields) {
+                Value transferred = transferValue(field, memo, account);
+                if (IS_EXCEPTION(transferred))
+                    return transferred;
+                copy->fields[name] = transferred;
+            }
+
+            return copy;
+        }
+
+        case ValueType::List: {
+            ListValue list = AS_LIST(value);
+            if (!fits(account, list->items.size() * sizeof(Value)))
+                return quotaExceeded();
+
+            ListValue copy = allocateIn<ListObj>(account, account);
+            memo[key] = copy;
+
+            copy->items.reserve(list->items.size());
+            for (Value &item : list->items) {
+                Value transferred = transferValue(item, memo, account);
+                if (IS_EXCEPTION(transferred))
+                    return transferred;
+                copy->items.push_back(transferred);
+            }
+
+            return copy;
+        }
+
+        case ValueType::StringBuilder: {
+            StringBuilderObj* builder = AS_STRING_BUILDER(value).get();
+            if (!fits(account, builder->text.size()))
+                return quotaExceeded();
+
+            StringBuilderValue copy = allocateIn<StringBuilderObj>(account, account);
+            copy->text = builder->text;
+            return memo[key] = copy;
+        }
+
+        case ValueType::TypedArray: {
+            TypedArrayObj* array = AS_TYPED_ARRAY(value).get();
+            if (!fits(account, array->float64.size() * sizeof(double) + array->int32.size() * sizeof(i32)))
+                return quotaExceeded();
+
+            TypedArrayValue copy = allocateIn<TypedArrayObj>(account, array->elementType, 0, account);
+
+            copy->float64.assign(array->float64.begin(), array->float64.end());
+            copy->int32.assign(array->int32.begin(), array->int32.end());
+
+            return memo[key] = copy;
+        }
+
+        case ValueType::Map: {
+            MapValue map = AS_MAP(value);
+            if (!fits(account, map->entries.size() * sizeof(MapObj::Entry)))
+                return quotaExceeded();
+
+            MapValue copy = allocateIn<MapObj>(account, account);
+            memo[key] = copy;
+
+            for (MapObj::Entry &entry : map->entries) {
+                if (entry.removed)
+                    continue;
+
+                Value copiedKey = transferValue(entry.key, memo, account);
+                if (IS_EXCEPTION(copiedKey))
+                    return copiedKey;
+
+                Value copiedValue = transferValue(entry.value, memo, account);
+                if (IS_EXCEPTION(copiedValue))
+                    return copiedValue;
+
+                copy->set(copiedKey, copiedValue);
+            }
+
+            return copy;
+        }
+
+        case ValueType::BoundMethod: {
+            BoundMethodValue bound = AS_BOUND_METHOD(value);
+            Value method = transferValue(bound->method, memo, account);
+            Value instance = transferValue(bound->instance, memo, account);
+
+            if (IS_EXCEPTION(method))
+                return method;
+            if (IS_EXCEPTION(instance))
+                return instance;
+
+            return memo[key] = allocateIn<BoundMethod>(account, AS_CLOSURE(method), instance);
+        }
+
+        // The user data belongs to the host, which is responsible for making it thread safe
+        case ValueType::Native: {
+            NativeValue native = AS_NATIVE(value);
+            return memo[key] = allocateIn<NativeObj>(account, native->name, native->function, native->userData);
+        }
+
+        default:
+            return std::make_shared<ExceptionObj>("Value can't be sent to another thread", ExceptionType::RuntimeError);
+    }
+}
+
+// Channel
+
+// Positions wrap with the mask, so there's always a power of two of cells
+static size_t cellCount(size_t capacity) {
+    size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    return size;
+}
+
+size_t Channel::footprint(size_t capacity) {
+    return cellCount(capacity) * sizeof(Cell);
+}
+
+Channel::Channel(size_t capacity) {
+    size_t size = cellCount(capacity);
+
+    cells = std::make_unique<Cell[]>(size);
+    mask = size - 1;
+
+    for (size_t index = 0; index < size; index++)
+        cells[index].sequence.store(index, std::memory_order_relaxed);
+
+    enqueuePos.store(0, std::memory_order_relaxed);
+    dequeuePos.store(0, std::memory_order_relaxed);
+}
+
+bool Channel::trySend(Value &value) {
+    size_t pos = enqueuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    for (;;) {
+        cell = &cells[pos & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) pos;
+
+        if (difference == 0) {
+            if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (difference < 0) {
+            return false;
+        } else {
+            pos = enqueuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool Channel::tryRecv(Value &value) {
+    size_t pos = dequeuePos.load(std::memory_order_relaxed);
+    Cell* cell;
+
+    for (;;) {
+        cell = &cells[pos & mask];
+        size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        intptr_t difference = (intptr_t) sequence - (intptr_t) (pos + 1);
+
+        if (difference == 0) {
+            if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        } else if (difference < 0) {
+            return false;
+        } else {
+            pos = dequeuePos.load(std::memory_order_relaxed);
+        }
+    }
+
+    value = std::move(cell->value);
+    cell->value = NONE_VAL();
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return true;
+}
+
+// Spin briefly for the common case of a busy peer, then give up the core. Returns false once
+// the wait is sleeping and expired says to stop.
+static bool backoff(int &attempt, const std::function<bool()> &expired) {
+    if (attempt < 64) {
+        attempt++;
+    } else if (attempt < 128) {
+        attempt++;
+        std::this_thread::yield();
+    } else {
+        if (expired())
+            return false;
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+    }
+
+    return true;
+}
+
+bool Channel::send(Value &value, const std::function<bool()> &expired) {
+    int attempt = 0;
+    while (!trySend(value)) {
+        if (!backoff(attempt, expired))
+            return false;
+    }
+    return true;
+}
+
+bool Channel::recv(Value &value, const std::function<bool()> &expired) {
+    int attempt = 0;
+    while (!tryRecv(value)) {
+        if (!backoff(attempt, expired))
+            return false;
+    }
+    return true;
+}
+
+// Thread
+
+// Adds the names of the globals a function tree defines, reads or writes to names. Decoded from
+// the bytecode rather than taken from the string constants, which also hold string literals
+// and property names. The tree has to be compiled, freezing it for the transfer makes sure.
+static void collectGlobalNames(FunctionObj* function, std::unordered_set<const FunctionObj*> &scanned, std::vector<std::string> &names) {
+    if (!scanned.insert(function).second)
+        return;
+
+    Chunk &chunk = function->chunk;
+    size_t index = 0;
+
+    while (index < chunk.bytecode.size()) {
+        u8 instruction = chunk.bytecode[index];
+
+        switch (instruction) {
+            case OpDefineGlobal:
+            case OpGetGlobal:
+            case OpSetGlobal:
+                names.push_back(AS_STRING(chunk.constants[chunk.bytecode[index + 1]]));
+                index += 2;
+                break;
+
+            case OpConstant:
+            case OpGetLocal:
+            case OpSetLocal:
+            case OpGetUpValue:
+            case OpSetUpValue:
+            case OpCall:
+            case OpClass:
+            case OpGetProperty:
+            case OpSetProperty:
+            case OpMethod:
+            case OpGetSuper:
+            case OpBuildList:
+            case OpBuildMap:
+            case OpImport:
+                index += 2;
+                break;
+
+            case OpJump:
+            case OpJumpBack:
+            case OpJumpIfTrue:
+            case OpJumpIfFalse:
+            case OpInvoke:
+                index += 3;
+                break;
+
+            case OpAddAssign:
+                if (chunk.bytecode[index + 1] == OpSetGlobal)
+                    names.push_back(AS_STRING(chunk.constants[chunk.bytecode[index + 2]]));
+                index += 3;
+                break;
+
+            case OpClosure: {
+                FunctionValue nested = AS_FUNCTION(chunk.constants[chunk.bytecode[index + 1]]);
+                index += 2 + 2 * nested->upValueCount;
+                break;
+            }
+
+            default:
+                index++;
+                break;
+        }
+    }
+
+    // Functions the code creates closures of at runtime
+    for (Value &constant : chunk.constants) {
+        if (IS_FUNCTION(constant))
+            collectGlobalNames(AS_FUNCTION(constant).get(), scanned, names);
+    }
+}
+
+// Copies the function, its arguments and the caller's globals its code refers to into the
+// child's heap. Copied values can hold closures of their own, whose globals are needed too, so
+// the copies are searched for new functions until no more names turn up. A referenced global
+// that can't be sent fails the spawn instead of leaving the thread to find it missing. The memo
+// goes away before the thread starts, after that only the thread may release what it holds.
+static bool seedThread(Interpreter &interpreter, Interpreter &child, Value callee, int argc, Value argv[], Value &function, std::vector<Value> &args, std::string &error) {
+    HeapAccount* account = child.heapAccount();
+    HeapScope charged(account);
+    TransferMemo memo;
+
+    function = transferValue(callee, memo, account);
+
+    if (IS_EXCEPTION(function)) {
+        error = AS_EXCEPTION(function)->msg;
+        return false;
+    }
+
+    for (int index = 0; index < argc; index++) {
+        args.push_back(transferValue(argv[index], memo, account));
+
+        if (IS_EXCEPTION(args.back())) {
+            error = AS_EXCEPTION(args.back())->msg;
+            return false;
+        }
+    }
+
+    const std::map<std::string, Value> &globals = interpreter.globalTable();
+    std::unordered_set<const FunctionObj*> scanned;
+    std::unordered_set<std::string> copied;
+    std::vector<std::string> names;
+
+    for (;;) {
+        for (auto &[key, copy] : memo) {
+            if (IS_CLOSURE(copy))
+                collectGlobalNames(AS_CLOSURE(copy)->function.get(), scanned, names);
+        }
+
+        if (names.empty())
+            return true;
+
+        std::vector<std::string> pending = std::move(names);
+        names.clear();
+
+        for (std::string &name : pending) {
+            auto global = globals.find(name);
+            if (global == globals.end() || !copied.insert(name).second)
+                continue;
+
+            Value transferred = transferValue(global->second, memo, account);
+
+            if (IS_EXCEPTION(transferred)) {
+                const std::string &reason = AS_EXCEPTION(transferred)->msg;
+                error = reason == heapQuotaError ? reason : formatStr("Can't send global %s: %s", name.c_str(), reason.c_str());
+                return false;
+            }
+
+            child.setGlobal(name, transferred);
+        }
+    }
+}
+
+ThreadValue spawnThread(Interpreter &interpreter, Value callee, int argc, Value argv[], std::string &error) {
+    // The thread runs under the same limits, copies of what it's given are charged to its heap
+    std::unique_ptr<Interpreter> child = std::make_unique<Interpreter>();
+    child->setLimits(interpreter.getLimits());
+
+    Value function;
+    std::vector<Value> args;
+
+    if (!seedThread(interpreter, *child, callee, argc, argv, function, args, error))
+        return nullptr;
+
+    std::string name = IS_CLOSURE(callee) ? AS_CLOSURE(callee)->function->name : "<native>";
+    ThreadValue thread = std::make_shared<ThreadObj>(name);
+    ThreadObj* state = thread.get();
+
+    child->output.setSink(interpreter.output.sink(), interpreter.output.sinkData());
+    for (const std::string &directory : interpreter.modulePaths())
+        child->addModulePath(directory);
+
+    // The profiler samples this thread's interpreter, its signal must not land on the new one
+    ProfilerSignalBlock unprofiled;
+
+    // The thread owns everything it was given, the ThreadObj joins it before going away
+    state->thread = std::thread([state, child = std::move(child), function = std::move(function), args = std::move(args)]() mutable {
+        // Declared first so the interpreter goes last, after every value charged to its heap
+        std::unique_ptr<Interpreter> runner = std::move(child);
+        Value callee = std::move(function);
+        std::vector<Value> arguments = std::move(args);
+
+        Value result;
+        if (runner->call(callee, arguments.data(), (int) arguments.size(), result) != InterpreterResult::Success) {
+            state->failed = true;
+            state->error = runner->lastError();
+        } else {
+            // The child's heap goes away with it, the result is held uncharged until a join
+            // copies it into the joining interpreter's heap
+            TransferMemo memo;
+            state->result = transferValue(result, memo, nullptr);
+
+            if (IS_EXCEPTION(state->result)) {
+                state->failed = true;
+                state->error = AS_EXCEPTION(state->result)->msg;
+                state->result = NONE_VAL();
+            }
+        }
+
+        state->finished.store(true, std::memory_order_release);
+    });
+
+    return thread;
+}
+
+ThreadObj::~ThreadObj() {
+    if (thread.joinable())
+        thread.join();
+}
+
+Value ThreadObj::join(HeapAccount* account, const std::function<bool()> &expired) {
+    if (!joined) {
+        int attempt = 0;
+        while (!finished.load(std::memory_order_acquire)) {
+            if (!backoff(attempt, expired))
+                return std::make_shared<ExceptionObj>(formatStr("Thread %s is still running", name.c_str()), ExceptionType::RuntimeError);
+        }
+
+        thread.join();
+        joined = true;
+    }
+
+    if (failed)
+        return std::make_shared<ExceptionObj>(formatStr("Thread %s failed: %s", name.c_str(), error.c_str()), ExceptionType::RuntimeError);
+
+    TransferMemo memo;
+    return transferValue(result, memo, account);
+}
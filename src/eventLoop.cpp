@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "eventLoop.h"
+#include "interpreter.h"
+#include "profiler.h"
+
+#if defined(__linux__) && !defined(EMSCRIPTEN)
+    #define EVENTLOOP_SUPPORTED
+    #include <sys/epoll.h>
+    #include <sys/eventfd.h>
+#endif
+
+#define EVENTLOOP_WORKERS 4
+#define EVENTLOOP_READ_CHUNK 65536
+
+// How long the loop waits at most before looking at the deadline and FIFOs without a reader
+#define EVENTLOOP_POLL_MS 10
+
+EventLoop::EventLoop() : pool(std::make_shared<WorkerPool>()) {
+#ifdef EVENTLOOP_SUPPORTED
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    pool->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = pool->wakeFd;
+    epoll_ctl(epollFd, EPOLL_CTL_ADD, pool->wakeFd, &event);
+#endif
+}
+
+// Idle workers exit once they see stopping, busy ones when their job is done
+EventLoop::~EventLoop() {
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->stopping = true;
+        pool->jobs.clear();
+    }
+
+    pool->wake.notify_all();
+
+    for (auto &[fd, operation] : pipes)
+        close(fd);
+
+    if (epollFd != -1) close(epollFd);
+}
+
+EventLoop::WorkerPool::~WorkerPool() {
+    if (wakeFd != -1) close(wakeFd);
+}
+
+void EventLoop::addTask(CoroutineValue task, std::vector<Value> args) {
+    liveTasks++;
+    ready.push_back(Ready{task, std::move(args)});
+}
+
+bool EventLoop::run(Interpreter &interpreter) {
+    while (liveTasks > 0) {
+        while (!ready.empty()) {
+            Ready next = std::move(ready.front());
+            ready.pop_front();
+
+            current = next.task;
+            currentWaiting = false;
+
+            Value result;
+            InterpreterResult status = interpreter.call(next.task, next.values.data(), (int) next.values.size(), result);
+            CoroutineValue task = std::move(current);
+            current = nullptr;
+
+            if (status != InterpreterResult::Success) {
+                abandon();
+                return false;
+            }
+
+            if (task->state == CoroutineState::Done) {
+                liveTasks--;
+            } else if (!currentWaiting) {
+                // A plain yield, let the other tasks run first
+                ready.push_back(Ready{task, {}});
+            }
+        }
+
+        if (liveTasks == 0 || waiting == 0)
+            break;
+
+#ifdef EVENTLOOP_SUPPORTED
+        epoll_event events[64];
+        int count = epoll_wait(epollFd, events, 64, nextTimeout());
+
+        for (int index = 0; index < count; index++) {
+            if (events[index].data.fd == pool->wakeFd) {
+                u64 signals;
+                while (read(pool->wakeFd, &signals, sizeof(signals)) > 0);
+                drainCompletions();
+            } else {
+                handlePipe(events[index].data.fd);
+            }
+        }
+
+        retryFifoWriters();
+#else
+        int timeout = nextTimeout();
+        if (timeout > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeout));
+#endif
+
+        fireTimers();
+
+        // Tasks waiting on I/O run no instructions, so nothing else would stop them in time
+        if (interpreter.timedOut()) {
+            abandon();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Drops every task, completions still in flight are ignored when they arrive
+void EventLoop::abandon() {
+    for (auto &[fd, operation] : pipes)
+        close(fd);
+
+    ready.clear();
+    timers.clear();
+    pipes.clear();
+    fifoWriters.clear();
+    submitted.clear();
+    liveTasks = waiting = 0;
+}
+
+void EventLoop::resumeWith(CoroutineValue task, const IoResult &result) {
+    waiting--;
+
+    // An exception resumed into a coroutine is raised there as a runtime error
+    if (!result.ok) {
+        ready.push_back(Ready{task, {std::make_shared<ExceptionObj>(result.error, ExceptionType::RuntimeError)}});
+    } else if (result.isNumber) {
+        ready.push_back(Ready{task, {NUMBER_VAL(result.number)}});
+    } else {
+        ready.push_back(Ready{task, {result.data}});
+    }
+}
+
+// Operations
+
+void EventLoop::readFile(const std::string &path) {
+    currentWaiting = true;
+    waiting++;
+
+#ifdef EVENTLOOP_SUPPORTED
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && S_ISFIFO(info.st_mode)) {
+        int fd = open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        if (fd != -1 && watchPipe(fd, false, current, ""))
+            return;
+    }
+
+    submit([path]() { return readFileNow(path); });
+#else
+    resumeWith(current, readFileNow(path));
+#endif
+}
+
+void EventLoop::writeFile(const std::string &path, std::string data) {
+    currentWaiting = true;
+    waiting++;
+
+#ifdef EVENTLOOP_SUPPORTED
+    // Opening a FIFO for writing without blocking fails until there's a reader. Waiting for one
+    // in a blocking open would tie up a worker for as long as nobody comes, the loop retries
+    // the open instead.
+    struct stat info;
+    if (stat(path.c_str(), &info) == 0 && S_ISFIFO(info.st_mode)) {
+        FifoWrite write{current, path, std::move(data)};
+        if (!openFifoWriter(write))
+            fifoWriters.push_back(std::move(write));
+        return;
+    }
+
+    submit([path, data = std::move(data)]() { return writeFileNow(path, data); });
+#else
+    resumeWith(current, writeFileNow(path, data));
+#endif
+}
+
+void EventLoop::sleep(double milliseconds) {
+    currentWaiting = true;
+    waiting++;
+
+    auto due = std::chrono::steady_clock::now() + std::chrono::microseconds((i64) (milliseconds * 1000));
+    timers.emplace(due, current);
+}
+
+IoResult EventLoop::readFileNow(const std::string &path) {
+    IoResult result;
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file.is_open()) {
+        result.ok = false;
+        result.error = formatStr("Could not open file '%s'", path.c_str());
+        return result;
+    }
+
+    std::stringstream stream;
+    stream << file.rdbuf();
+    result.data = stream.str();
+    return result;
+}
+
+IoResult EventLoop::writeFileNow(const std::string &path, const std::string &data) {
+    IoResult result;
+    std::ofstream file(path, std::ios::binary);
+
+    if (!file.is_open() || !file.write(data.data(), data.size())) {
+        result.ok = false;
+        result.error = formatStr("Could not write file '%s'", path.c_str());
+        return result;
+    }
+
+    result.isNumber = true;
+    result.number = (double) data.size();
+    return result;
+}
+
+// Pipes
+
+bool EventLoop::watchPipe(int fd, bool writing, CoroutineValue task, std::string data) {
+#ifdef EVENTLOOP_SUPPORTED
+    epoll_event event = {};
+    event.events = writing ? EPOLLOUT : EPOLLIN;
+    event.data.fd = fd;
+
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        close(fd);
+        return false;
+    }
+
+    pipes[fd] = PipeOperation{task, writing, std::move(data)};
+    return true;
+#else
+    return false;
+#endif
+}
+
+// False while the FIFO has no reader, otherwise the write is under way or has failed
+bool EventLoop::openFifoWriter(FifoWrite &write) {
+#ifdef EVENTLOOP_SUPPORTED
+    int fd = open(write.path.c_str(), O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+
+    if (fd == -1 && errno == ENXIO)
+        return false;
+
+    if (fd == -1 || !watchPipe(fd, true, write.task, std::move(write.data))) {
+        IoResult result;
+        result.ok = false;
+        result.error = formatStr("Could not write file '%s'", write.path.c_str());
+        resumeWith(write.task, result);
+    }
+#endif
+    return true;
+}
+
+void EventLoop::retryFifoWriters() {
+    std::erase_if(fifoWriters, [this](FifoWrite &write) { return openFifoWriter(write); });
+}
+
+// Reads or writes as much as the pipe allows without blocking
+void EventLoop::handlePipe(int fd) {
+#ifdef EVENTLOOP_SUPPORTED
+    auto found = pipes.find(fd);
+    if (found == pipes.end())
+        return;
+
+    PipeOperation &operation = found->second;
+    IoResult result;
+    bool finished = false;
+
+    if (operation.writing) {
+        while (operation.written < operation.data.size()) {
+            ssize_t count = write(fd, operation.data.data() + operation.written, operation.data.size() - operation.written);
+            if (count <= 0) break;
+            operation.written += count;
+        }
+
+        if (operation.written == operation.data.size()) {
+            finished = true;
+            result.isNumber = true;
+            result.number = (double) operation.written;
+        } else if (errno != EAGAIN) {
+            finished = true;
+            result.ok = false;
+            result.error = "Could not write to pipe";
+        }
+    } else {
+        char buffer[EVENTLOOP_READ_CHUNK];
+        ssize_t count;
+
+        while ((count = read(fd, buffer, sizeof(buffer))) > 0)
+            operation.data.append(buffer, count);
+
+        // Zero is end of file, the writer closed its side
+        if (count == 0) {
+            finished = true;
+            result.data = std::move(operation.data);
+        } else if (errno != EAGAIN) {
+            finished = true;
+            result.ok = false;
+            result.error = "Could not read from pipe";
+        }
+    }
+
+    if (finished) {
+        CoroutineValue task = operation.task;
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        pipes.erase(found);
+        resumeWith(task, result);
+    }
+#endif
+}
+
+// Worker pool
+
+void EventLoop::submit(std::function<IoResult()> job) {
+    if (!workersStarted) {
+        ProfilerSignalBlock unprofiled;
+
+        for (int index = 0; index < EVENTLOOP_WORKERS; index++)
+            std::thread(&EventLoop::workerLoop, pool).detach();
+
+        workersStarted = true;
+    }
+
+    u64 id = nextJobId++;
+    submitted[id] = current;
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        pool->jobs.emplace_back(id, std::move(job));
+    }
+
+    pool->wake.notify_one();
+}
+
+void EventLoop::workerLoop(std::shared_ptr<WorkerPool> pool) {
+    for (;;) {
+        std::pair<u64, std::function<IoResult()>> job;
+
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            pool->wake.wait(guard, [&pool]() { return pool->stopping || !pool->jobs.empty(); });
+
+            if (pool->stopping)
+                return;
+
+            job = std::move(pool->jobs.front());
+            pool->jobs.pop_front();
+        }
+
+        IoResult result = job.second();
+
+        {
+            std::lock_guard<std::mutex> guard(pool->lock);
+            pool->completions.push_back(Completion{job.first, std::move(result)});
+        }
+
+        u64 signal = 1;
+        write(pool->wakeFd, &signal, sizeof(signal));
+    }
+}
+
+void EventLoop::drainCompletions() {
+    std::vector<Completion> done;
+
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        done.swap(pool->completions);
+    }
+
+    for (Completion &completion : done) {
+        auto task = submitted.find(completion.id);
+        if (task == submitted.end())
+            continue;
+
+        CoroutineValue coroutine = task->second;
+        submitted.erase(task);
+        resumeWith(coroutine, completion.result);
+    }
+}
+
+// Timers
+
+int EventLoop::nextTimeout() {
+    if (!ready.empty())
+        return 0;
+
+    if (timers.empty())
+        return EVENTLOOP_POLL_MS;
+
+    auto remaining = timers.begin()->first - std::chrono::steady_clock::now();
+    i64 milliseconds = std::chrono::ceil<std::chrono::milliseconds>(remaining).count();
+    return (int) std::clamp<i64>(milliseconds, 0, EVENTLOOP_POLL_MS);
+}
+
+void EventLoop::fireTimers() {
+    auto now = std::chrono::steady_clock::now();
+
+    while (!timers.empty() && timers.begin()->first <= now) {
+        CoroutineValue task = timers.begin()->second;
+        timers.erase(timers.begin());
+
+        IoResult result;
+        result.isNumber = true;
+        resumeWith(task, result);
+    }
+}
@@ -0,0 +1,158 @@
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "file.h"
+
+// File
+
+FileObj::~FileObj() {
+    close();
+}
+
+bool FileObj::open() {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    capacity = FILE_BUFFER_SIZE;
+    buffer = std::make_shared<StringValue>(capacity, '\0');
+    return true;
+}
+
+void FileObj::close() {
+    if (fd != -1)
+        ::close(fd);
+
+    fd = -1;
+    buffer.reset();
+    start = end = 0;
+}
+
+// Moves the unread part of the buffer to the front and reads more after it. The buffer is
+// replaced instead when lines read from it are still alive, and grows only when it's already
+// full of one unfinished line.
+bool FileObj::fill() {
+    if (atEnd)
+        return false;
+
+    size_t unread = end - start;
+
+    if (unread == capacity || (start > 0 && buffer.use_count() > 1)) {
+        size_t size = unread == capacity ? capacity * 2 : capacity;
+        std::shared_ptr<StringValue> fresh = std::make_shared<StringValue>(size, '\0');
+        memcpy(fresh->data(), buffer->data() + start, unread);
+        buffer = std::move(fresh);
+        capacity = size;
+    } else if (start > 0) {
+        memmove(buffer->data(), buffer->data() + start, unread);
+    }
+
+    start = 0;
+    end = unread;
+
+    ssize_t count = read(fd, buffer->data() + end, capacity - end);
+
+    if (count <= 0) {
+        atEnd = true;
+        return false;
+    }
+
+    end += count;
+    return true;
+}
+
+std::optional<StringSlice> FileObj::readLine() {
+    if (fd == -1)
+        return std::nullopt;
+
+    size_t searched = start;
+
+    for (;;) {
+        const char* text = buffer->data();
+        const char* newline = (const char*) memchr(text + searched, '\n', end - searched);
+
+        if (newline != nullptr) {
+            size_t length = newline - (text + start);
+            if (length > 0 && text[start + length - 1] == '\r')
+                length--;
+
+            StringSlice line(buffer, start, length);
+            start = newline - text + 1;
+            return line;
+        }
+
+        searched = end - start;
+
+        if (!fill()) {
+            // Last line without a trailing newline
+            if (start == end)
+                return std::nullopt;
+
+            StringSlice line(buffer, start, end - start);
+            start = end;
+            return line;
+        }
+
+        searched += start;
+    }
+}
+
+size_t FileObj::size() {
+    struct stat info;
+
+    if (fd == -1 || fstat(fd, &info) != 0)
+        return 0;
+
+    return info.st_size;
+}
+
+// Mapped file
+
+MappedFileObj::~MappedFileObj() {
+    unmap();
+}
+
+bool MappedFileObj::map() {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (fd == -1)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    length = info.st_size;
+
+    // mmap rejects empty mappings, an empty file just has no data
+    if (length > 0) {
+        address = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (address == MAP_FAILED) {
+            address = nullptr;
+            length = 0;
+            ::close(fd);
+            return false;
+        }
+    }
+
+    ::close(fd);
+    return true;
+}
+
+void MappedFileObj::unmap() {
+    if (address != nullptr)
+        munmap(address, length);
+
+    address = nullptr;
+    length = 0;
+}
@@ -41,5 +41,27 @@ enum Bytecode : u8 {
     OpMethod,
     OpInvoke,
     OpInherit,
-    OpGetSuper
+    OpGetSuper,
+    OpYield,
+    OpBuildList,
+    OpBuildMap,
+    OpIndexGet,
+    OpIndexSet,
+    OpAddAssign,
+    OpImport,
+    OpThrow
+};
+
+
+// Same order as Bytecode
+inline const char* opcodeNames[] = {
+    "Pop", "Return", "Constant", "True", "False", "None",
+    "Add", "Subtract", "Multiply", "Divide",
+    "Equal", "NotEqual", "Greater", "Less", "GreaterEqual", "LessEqual",
+    "Not", "Negate", "Print",
+    "DefineGlobal", "GetGlobal", "SetGlobal", "GetLocal", "SetLocal",
+    "GetUpValue", "SetUpValue", "CloseUpValue",
+    "Jump", "JumpBack", "JumpIfTrue", "JumpIfFalse",
+    "Call", "Closure", "Class", "GetProperty", "SetProperty", "Method", "Invoke", "Inherit", "GetSuper", "Yield",
+    "BuildList", "BuildMap", "IndexGet", "IndexSet", "AddAssign", "Import", "Throw"
 };
@@ -1,12 +1,11 @@
 #pragma once
 #include <ostream>
+#include <string_view>
 #include <vector>
 #include <string.h>
 #include <map>
 #include "debug.h"
 
-#define DEBUGINFO
-
 #define UINT8_COUNT 256
 #define UINT8_MAX 255
 
@@ -25,3 +24,7 @@ typedef int32_t  i32;
 typedef int64_t  i64;
 
 std::string formatStr(const char* fmt, ...);
+
+// Reads a whole decimal number like 12, -0.5, .5 or 1e9 without allocating, surrounding spaces
+// and a leading + are allowed. False if anything else is left over.
+bool parseNumber(std::string_view text, double &value);
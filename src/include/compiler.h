@@ -15,7 +15,7 @@ enum class Precedence {
     Term,        // + -
     Factor,      // * /
     Unary,       // ! -
-    Call,        // . ()
+    Call,        // . () []
     Primary
 };
 
@@ -47,6 +47,10 @@ struct UpValue {
 
 class Compiler {
 public:
+    // Names a lazily compiled function captured, in upvalue order. It has no enclosing
+    // compiler, these stand in for the enclosing scopes it was declared in.
+    const std::vector<Token>* capturedNames = nullptr;
+
     int localCount;
     int scopeDepth;
     int localStackOffset;
@@ -65,16 +69,44 @@ public:
     bool hasSuperClass;
 };
 
+// What's needed to compile a function body on its first call. With lazy compilation the
+// compiler only scans a function's body for its extent and the names it might capture, it
+// captures every one of them that resolves to a local or upvalue where it's declared. That
+// can capture more than the body uses but never less.
+class LazyFunction {
+public:
+    std::shared_ptr<const std::string> source;
+    size_t offset;  // of the parameter list
+    int line;
+    FunctionType type;
+    bool inClass;
+    bool hasSuperClass;
+    std::vector<Token> capturedNames;
+};
+
+// Compiles a lazy function's body into it. On a syntax error nothing is printed, it returns false
+// with the message in error for the caller to raise where the function was called.
+bool compileLazyFunction(FunctionObj* function, std::string &error);
+
 class Parser {
 public:
-    Parser(const char* source);
+    // A lazy parser keeps its own copy of the source for the bodies it skips
+    Parser(const char* source, bool lazy=false);
+    Parser(std::shared_ptr<const std::string> source);
+
+    // With echoResult, a script ending in an expression statement prints its value
+    FunctionValue compile(bool echoResult=false);
+    bool compileLazy(FunctionObj* function);
 
-    FunctionValue compile();
+    // Where syntax errors go instead of being printed, set for bodies compiled while running
+    std::string* diagnostics = nullptr;
 
 private:
     bool hadError;
     bool canAssign;
-    int currentLineNumber;
+    bool lazy;
+    bool echoResult = false;
+    std::shared_ptr<const std::string> sharedSource;
     const char* source;
     Token currentToken;
     Token previousToken;
@@ -122,12 +154,16 @@ private:
     void __or__();
     void __this__();
     void __super__();
+    void __yield__();
     void number();
     void variable();
     void string();
     void literal();
     void grouping();
     void call();
+    void list();
+    void map();
+    void subscript();
     void dot();
     void unary();
     void binary();
@@ -140,11 +176,17 @@ private:
     void block();
 
     void function(FunctionType type);
+    void functionBody();
+    void parameters();
+    void lazyFunction(FunctionType type);
+    void emitClosure(FunctionValue function, Compiler &funcCompiler);
     void method();
 
     void expressionStatement();
     void printStatement();
     void returnStatement();
+    void tryStatement();
+    void throwStatement();
     void ifStatement();
     void whileLoop();
     void forLoop();
@@ -152,6 +194,7 @@ private:
     
     void varDeclaration(); 
     void funcDeclaration();
+    void importDeclaration();
     void classDeclaration();
     void declaration();
 };
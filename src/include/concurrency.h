@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <unordered_map>
+#include "common.h"
+#include "value.h"
+
+// Threads and channels for scripts. Every spawned thread runs on its own Interpreter, so no
+// runtime object is ever reachable from two threads: values cross over as deep copies made by
+// transferValue. Compiled functions are frozen and shared, channels are shared by design.
+
+using TransferMemo = std::unordered_map<const void*, Value>;
+
+// Copies a value graph for another thread, preserving sharing and cycles. Copies are charged to
+// account, the receiving interpreter's heap, or to nothing when it's null. Returns an Exception
+// for values that can't cross threads or that would take account over its quota.
+Value transferValue(const Value &value, TransferMemo &memo, HeapAccount* account);
+
+// Bounded lock-free multi-producer multi-consumer queue (Vyukov). Each cell carries a sequence
+// number telling producers and consumers whose turn it is, so the only shared writes are the
+// two position counters.
+class Channel {
+public:
+    Channel(size_t capacity);
+
+    bool trySend(Value &value);
+    bool tryRecv(Value &value);
+
+    // Block with backoff until the operation succeeds. Once waiting has come down to sleeping,
+    // expired is polled between sleeps and the wait gives up when it returns true.
+    bool send(Value &value, const std::function<bool()> &expired);
+    bool recv(Value &value, const std::function<bool()> &expired);
+
+    size_t capacity() { return mask + 1; }
+
+    // What the cells of a channel with room for capacity values take up
+    static size_t footprint(size_t capacity);
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Value value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+    size_t mask;
+
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+};
+
+// The cells are charged to the heap of the interpreter that made the channel, for as long as
+// any thread still holds it
+class ChannelObj {
+public:
+    Channel channel;
+    SharedCharge charge;
+
+    ChannelObj(size_t capacity, HeapAccount* account) : channel(capacity), charge(account, Channel::footprint(capacity)) {};
+};
+
+class ThreadObj {
+public:
+    std::string name;
+    std::thread thread;
+    bool joined = false;
+
+    // Written by the thread before it sets finished, read after join. The result isn't charged
+    // to any heap, join hands out a copy charged to the joining interpreter's.
+    std::atomic<bool> finished = false;
+    bool failed = false;
+    std::string error;
+    Value result;
+
+    ThreadObj(std::string name) : name(name) {};
+    ~ThreadObj();
+
+    // Waits like Channel::recv, returns an Exception if expired gave up on the thread
+    Value join(HeapAccount* account, const std::function<bool()> &expired);
+};
+
+// Runs callee(argv...) on a new thread with its own Interpreter, seeded with copies of the
+// caller's globals and running under the caller's limits. Returns nullptr and sets error if the
+// function or an argument can't be sent, or if the copies don't fit in the thread's heap quota.
+ThreadValue spawnThread(Interpreter &interpreter, Value callee, int argc, Value argv[], std::string &error);
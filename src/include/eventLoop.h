@@ -0,0 +1,120 @@
+#pragma once
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "common.h"
+#include "value.h"
+
+class Interpreter;
+
+// Result of a blocking operation, filled in off the interpreter thread so it holds no Values
+struct IoResult {
+    bool ok = true;
+    bool isNumber = false;
+    std::string data;
+    double number = 0;
+    std::string error;
+};
+
+// Runs coroutines as tasks on one thread. A task calling an I/O native is suspended until the
+// operation completes, so many reads and writes can be in flight at once. Pipes and FIFOs are
+// polled with epoll, regular files can't be so their reads and writes go to a small worker pool
+// which signals completion through an eventfd. Without epoll every operation runs inline.
+// Waiting stops at the interpreter's deadline like running does.
+class EventLoop {
+public:
+    EventLoop();
+    ~EventLoop();
+
+    void addTask(CoroutineValue task, std::vector<Value> args);
+
+    // Runs until every task has finished, false if one failed with a runtime error
+    bool run(Interpreter &interpreter);
+
+    // True while a task started by run() is executing, I/O natives suspend it instead of blocking
+    bool inTask() { return current != nullptr; }
+
+    // Called by natives from inside a task, the task is resumed with the result
+    void readFile(const std::string &path);
+    void writeFile(const std::string &path, std::string data);
+    void sleep(double milliseconds);
+
+    // Blocking versions used outside of tasks
+    static IoResult readFileNow(const std::string &path);
+    static IoResult writeFileNow(const std::string &path, const std::string &data);
+
+private:
+    struct Ready {
+        CoroutineValue task;
+        std::vector<Value> values;
+    };
+
+    struct PipeOperation {
+        CoroutineValue task;
+        bool writing;
+        std::string data;
+        size_t written = 0;
+    };
+
+    // A write to a FIFO nobody has opened for reading yet
+    struct FifoWrite {
+        CoroutineValue task;
+        std::string path;
+        std::string data;
+    };
+
+    // Workers only see the job id, the task stays on the interpreter's thread
+    struct Completion {
+        u64 id;
+        IoResult result;
+    };
+
+    // Shared with the workers, which are detached: one stuck in a job can't hold up the
+    // loop's destruction and keeps this alive until it's done
+    struct WorkerPool {
+        std::mutex lock;
+        std::condition_variable wake;
+        std::deque<std::pair<u64, std::function<IoResult()>>> jobs;
+        std::vector<Completion> completions;
+        bool stopping = false;
+        int wakeFd = -1;
+
+        ~WorkerPool();
+    };
+
+    void resumeWith(CoroutineValue task, const IoResult &result);
+    void abandon();
+    void submit(std::function<IoResult()> job);
+    bool watchPipe(int fd, bool writing, CoroutineValue task, std::string data);
+    bool openFifoWriter(FifoWrite &write);
+    void retryFifoWriters();
+    void handlePipe(int fd);
+    void drainCompletions();
+    void fireTimers();
+    int nextTimeout();
+    static void workerLoop(std::shared_ptr<WorkerPool> pool);
+
+    std::deque<Ready> ready;
+    CoroutineValue current;
+    bool currentWaiting = false;
+    int liveTasks = 0;
+    int waiting = 0;
+
+    std::multimap<std::chrono::steady_clock::time_point, CoroutineValue> timers;
+    std::unordered_map<int, PipeOperation> pipes;
+    std::vector<FifoWrite> fifoWriters;
+
+    int epollFd = -1;
+
+    // Worker pool, started on the first regular file operation
+    std::shared_ptr<WorkerPool> pool;
+    bool workersStarted = false;
+    std::unordered_map<u64, CoroutineValue> submitted;
+    u64 nextJobId = 0;
+};
@@ -0,0 +1,59 @@
+#pragma once
+#include <memory>
+#include <optional>
+#include "common.h"
+#include "value.h"
+
+#define FILE_BUFFER_SIZE (1 << 18)
+
+// Read-only file handle with a buffered line reader. Lines are slices of the buffer, which is
+// reused for the whole file while no line read from it is still alive and only grows when a
+// single line doesn't fit, so reading a file of any size takes memory proportional to its
+// longest line. A buffer that lines still point into is left to them and the reader moves on
+// to a fresh one.
+class FileObj {
+public:
+    std::string path;
+
+    FileObj(std::string path) : path(path) {};
+    ~FileObj();
+
+    bool open();
+    void close();
+    bool isOpen() { return fd != -1; }
+
+    // Next line without its line ending, nothing at end of file
+    std::optional<StringSlice> readLine();
+    size_t size();
+
+private:
+    bool fill();
+
+    int fd = -1;
+    // Bytes before end never change while a slice holds the buffer, later ones are only written
+    // by the reader
+    std::shared_ptr<StringValue> buffer;
+    size_t capacity = 0;
+    size_t start = 0;
+    size_t end = 0;
+    bool atEnd = false;
+};
+
+// Whole file mapped into memory for random access, pages are read in by the OS on demand
+class MappedFileObj {
+public:
+    std::string path;
+
+    MappedFileObj(std::string path) : path(path) {};
+    ~MappedFileObj();
+
+    bool map();
+    void unmap();
+
+    const char* data() { return (const char*) address; }
+    size_t size() { return length; }
+
+private:
+    void* address = nullptr;
+    size_t length = 0;
+};
@@ -0,0 +1,197 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include "common.h"
+
+// Byte accounting for objects an interpreter allocates, used to enforce a heap quota.
+// Objects are created through AccountedAllocator so their memory is charged on allocation
+// and released when the last reference drops. A host may keep values after their interpreter
+// is gone, so the interpreter doesn't own its account outright, see HeapOwner: an account that
+// still has objects charged to it when the interpreter goes away is detached and frees itself
+// once the last of them is released. A null account charges nothing, used for copies handed
+// between threads.
+class HeapAccount {
+public:
+    size_t bytes = 0;
+    size_t limit = 0;
+    bool exceeded = false;
+
+    // Objects shared between threads, like channels, can be released on any of them. They're
+    // counted here instead of in bytes, see SharedCharge.
+    std::shared_ptr<std::atomic<size_t>> shared = std::make_shared<std::atomic<size_t>>(0);
+
+    // Set to -1 when the quota is exceeded so the interpreter notices at its next limit check
+    i64* interrupt = nullptr;
+
+    inline void charge(size_t size) {
+        bytes += size;
+        blocks++;
+
+        if (limit && bytes + shared->load(std::memory_order_relaxed) > limit && !exceeded) {
+            exceeded = true;
+            if (interrupt) *interrupt = -1;
+        }
+    }
+
+    inline void release(size_t size) {
+        bytes -= size;
+
+        if (--blocks == 0 && detached)
+            delete this;
+    }
+
+    // Called by the owner instead of deleting, the quota and the interrupt go with the owner
+    void detach() {
+        if (blocks == 0) {
+            delete this;
+            return;
+        }
+
+        detached = true;
+        limit = 0;
+        interrupt = nullptr;
+    }
+
+    inline bool canAllocate(size_t size) {
+        return !limit || bytes + shared->load(std::memory_order_relaxed) + size <= limit;
+    }
+
+    // What allocations on this thread are charged to when the code making them has no account
+    // at hand, see HeapScope and CurrentAccountAllocator
+    static inline thread_local HeapAccount* current = nullptr;
+
+private:
+    // Charges not yet released, the account can only be freed when there are none
+    size_t blocks = 0;
+    bool detached = false;
+};
+
+// An interpreter's account, declared before anything that holds values. Values the host still
+// holds when the owner goes away keep the account alive, see HeapAccount::detach.
+class HeapOwner {
+public:
+    HeapOwner() : account(new HeapAccount()) {};
+    ~HeapOwner() { account->detach(); }
+
+    HeapOwner(const HeapOwner &) = delete;
+    HeapOwner &operator=(const HeapOwner &) = delete;
+
+    HeapAccount* get() { return account; }
+    HeapAccount* operator->() { return account; }
+
+private:
+    HeapAccount* account;
+};
+
+// Charges size to account's shared count for as long as it lives, from whichever thread drops
+// it last. Holds the count rather than the account, which may be gone by then.
+class SharedCharge {
+public:
+    SharedCharge(HeapAccount* account, size_t size) : size(size) {
+        if (account == nullptr)
+            return;
+
+        counter = account->shared;
+        counter->fetch_add(size, std::memory_order_relaxed);
+    }
+
+    ~SharedCharge() {
+        if (counter) counter->fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    SharedCharge(const SharedCharge &) = delete;
+    SharedCharge &operator=(const SharedCharge &) = delete;
+
+private:
+    std::shared_ptr<std::atomic<size_t>> counter;
+    size_t size;
+};
+
+// Charges allocations on this thread to account while in scope. An interpreter runs scripts in
+// one, code that hands values to another thread or keeps them past the interpreter opens one
+// with the account that should pay for the copies, or with none.
+class HeapScope {
+public:
+    HeapScope(HeapAccount* account) : previous(HeapAccount::current) {
+        HeapAccount::current = account;
+    }
+
+    ~HeapScope() {
+        HeapAccount::current = previous;
+    }
+
+    HeapScope(const HeapScope &) = delete;
+    HeapScope &operator=(const HeapScope &) = delete;
+
+private:
+    HeapAccount* previous;
+};
+
+template <typename T>
+class AccountedAllocator {
+public:
+    using value_type = T;
+
+    HeapAccount* account;
+
+    AccountedAllocator(HeapAccount* account) : account(account) {};
+
+    template <typename U>
+    AccountedAllocator(const AccountedAllocator<U> &other) : account(other.account) {};
+
+    T* allocate(size_t count) {
+        if (account) account->charge(count * sizeof(T));
+        return std::allocator<T>().allocate(count);
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        if (account) account->release(count * sizeof(T));
+        std::allocator<T>().deallocate(pointer, count);
+    }
+
+    template <typename U>
+    bool operator==(const AccountedAllocator<U> &other) const {
+        return account == other.account;
+    }
+};
+
+// For strings, which are made everywhere, most often far from any account. Charges the
+// thread's current account and keeps a pointer to it in front of the block, so the block is
+// released to the account it was charged to wherever it's freed. Being stateless keeps the
+// strings themselves as small as std::string.
+template <typename T>
+class CurrentAccountAllocator {
+public:
+    using value_type = T;
+
+    static constexpr size_t headerSize = alignof(std::max_align_t);
+
+    CurrentAccountAllocator() = default;
+
+    template <typename U>
+    CurrentAccountAllocator(const CurrentAccountAllocator<U> &) {};
+
+    T* allocate(size_t count) {
+        HeapAccount* account = HeapAccount::current;
+        if (account) account->charge(count * sizeof(T));
+
+        char* block = (char*) ::operator new(count * sizeof(T) + headerSize);
+        *(HeapAccount**) block = account;
+        return (T*) (block + headerSize);
+    }
+
+    void deallocate(T* pointer, size_t count) {
+        char* block = (char*) pointer - headerSize;
+        HeapAccount* account = *(HeapAccount**) block;
+
+        if (account) account->release(count * sizeof(T));
+        ::operator delete(block);
+    }
+
+    template <typename U>
+    bool operator==(const CurrentAccountAllocator<U> &) const {
+        return true;
+    }
+};
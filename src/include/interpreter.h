@@ -1,19 +1,40 @@
 #pragma once
+#include <chrono>
 #include "common.h"
 #include "scanner.h"
 #include "jakelang.h"
 #include "nativeFuncs.h"
 #include "value.h"
 #include "bytecode.h"
+#include "opcodeStats.h"
+#include "heap.h"
+#include "output.h"
 
 #define FRAMES_MAX 64
 #define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define FUEL_SLICE 65536
+
+// Coroutines start with this much and double as they need more, up to the main fiber's size
+#define COROUTINE_FRAMES_START 16
+#define COROUTINE_STACK_START 1024
 
 const std::string constructorName = "init";
 
 enum class InterpreterResult {
     Success,
-    Error
+    Error,
+    InstructionLimit,
+    MemoryLimit,
+    Timeout
+};
+
+// Limits for running untrusted scripts, zero means unlimited. The instruction budget is counted
+// in bytecode bytes: backward jumps charge the loop body and calls charge the callee's chunk,
+// which bounds the number of instructions a script can execute.
+struct InterpreterLimits {
+    u64 instructionBudget = 0;
+    size_t heapBytes = 0;
+    std::chrono::milliseconds timeout = std::chrono::milliseconds(0);
 };
 
 class CallFrame {
@@ -26,14 +47,152 @@ public:
     CallFrame(ClosureValue closure, Value* stack) : ip(closure->function->chunk.bytecode.data()), closure(closure), slots(stack) {};
 };
 
+// The frames and stack the interpreter is currently running on. The main fiber uses the
+// interpreter's own arrays, every coroutine has its own, which start smaller and grow. Switching
+// between them swaps these fields in and out of the interpreter.
+struct Fiber {
+    CallFrame* frames = nullptr;
+    int framesMax = 0;
+    int frameCount = 0;
+    int frameHighWater = 0;
+
+    Value* stack = nullptr;
+    Value* stackLimit = nullptr;
+    Value* sp = nullptr;
+    Value* stackHighWater = nullptr;
+
+    UpValuePtrValue openUpValues = NULL;
+
+    // Who resumed this fiber and gets control back when it yields or returns
+    Fiber* resumer = nullptr;
+    CoroutineObj* coroutine = nullptr;
+};
+
+enum class CoroutineState {
+    Fresh,
+    Suspended,
+    Running,
+    Done
+};
+
+class CoroutineObj {
+public:
+    ClosureValue closure;
+    CoroutineState state = CoroutineState::Fresh;
+    Fiber fiber;
+
+    // How many host calls deep the interpreter was when this was resumed, yielding is only
+    // possible from the same depth since a native's C++ frame can't be suspended
+    int nativeDepth = 0;
+
+    CoroutineObj(ClosureValue closure, HeapAccount* account) : closure(closure), account(account) {};
+    ~CoroutineObj();
+
+    void allocate();
+    void release();
+    bool grow();
+
+private:
+    HeapAccount* account;
+    std::unique_ptr<CallFrame[]> frames;
+    std::unique_ptr<Value[]> stack;
+    int framesCapacity = 0;
+    int stackCapacity = 0;
+
+    size_t footprint() { return framesCapacity * sizeof(CallFrame) + stackCapacity * sizeof(Value); }
+};
+
+class EventLoop;
+
 class Interpreter {
+    friend class Profiler;
+
 public:
     Interpreter();
+    ~Interpreter();
     InterpreterResult interpret(const char* source);
+    FunctionValue compile(const char* source, bool echoResult = false);
+    InterpreterResult execute(FunctionValue function);
+
+    // Reuse: snapshot() marks the current globals (natives, preloaded code) as the pristine
+    // state, reset() drops everything scripts created since then so the next job starts clean
+    void snapshot();
+    void reset();
+
+    void setLimits(InterpreterLimits limits);
+    const InterpreterLimits &getLimits();
+    size_t heapBytes();
+
+    // For host natives that create objects, which should be charged to this interpreter
+    HeapAccount* heapAccount();
+
+    // For host natives that block: polls the script's deadline. Once it has passed the script
+    // is stopped with a timeout, the native should stop waiting and return an error, which the
+    // script can't catch.
+    bool timedOut();
+
+    // Embedding: call a Jake++ value from the host once a script has been executed. Calls may
+    // nest, a native called by a script can call back into it.
+    InterpreterResult call(Value callee, const Value* args, int argc, Value &result);
+    bool getGlobal(const std::string &name, Value &value);
+    void setGlobal(const std::string &name, Value value);
+    const std::map<std::string, Value> &globalTable();
+    void defineNative(std::string name, NativeFn function);
+    void defineNative(std::string name, HostFn function, void* userData);
+    const std::string &lastError();
+
+    CoroutineValue makeCoroutine(ClosureValue closure);
+
+    // Modules: import looks for name.jake in these directories in order, then in JAKEPATH.
+    // With the cache on, compiled modules are saved next to their source and reused while the
+    // source is unchanged.
+    void addModulePath(const std::string &directory);
+    const std::vector<std::string> &modulePaths();
+    void setModuleCache(bool enabled);
+
+    // Compile function bodies on their first call instead of up front, see LazyFunction
+    void setLazyCompile(bool enabled);
+
+    // Called by a host native to suspend the coroutine calling it once the native returns. The
+    // coroutine's resumer gets control back, the value it resumes with is the native's result.
+    void suspend();
+
+    // Returned by a host native after a call() from inside a script failed, raises what the
+    // call threw in the script that called the native instead of a new error. Only the
+    // outermost run reports an error nothing catches, nested ones leave it to their caller.
+    Value propagateError();
+    EventLoop &eventLoop();
+
+    // Where print statements go, flushed when full, after a script runs, before errors are
+    // reported and when the interpreter is destroyed
+    Output output;
+
+    #ifdef OPCODESTATS
+        OpcodeStats opcodeStats;
+    #endif
 
 private:
-    InterpreterResult run();
+    InterpreterResult run(int baseFrame, Fiber* baseFiber);
+
+    // Errors: runtimeError raises msg as an exception a try block can catch, it's only printed
+    // once nothing catches it. fatalError is for limits, which stop the script regardless.
     void runtimeError(std::string msg);
+    void fatalError(std::string msg);
+    void reportError();
+    void captureTrace();
+    bool catchError(int baseFrame, Fiber* baseFiber);
+    bool isOutermost(int baseFrame, Fiber* baseFiber);
+
+    // Limits
+    void startLimits();
+    void refillFuel();
+    bool checkLimits();
+    bool stopForLimit(InterpreterResult result, const char* msg);
+
+    template <typename T, typename... Args>
+    std::shared_ptr<T> allocate(Args&&... args) {
+        return std::allocate_shared<T>(AccountedAllocator<T>(heap.get()), std::forward<Args>(args)...);
+    }
     
     // Stack
     void push(Value value);
@@ -47,31 +206,88 @@ private:
     
     // Inherit
     bool bindMethod(ClassValue klass, std::string name);
+    bool indexGet(Value &container, Value &index);
+    bool indexSet(Value &container, Value &index, Value &value);
     void inhertClass(ClassValue subClass, ClassValue baseClass);
 
     // Define
-    void defineNative(std::string name, NativeFn function);
     void defineMethod(std::string name);
 
     // Call
     bool callValue(Value value, u8 argc);
     bool callClosure(ClosureValue closure, u8 argc);
     bool callNativeFunction(NativeFuncValue nativeFunc, u8 argc);
+    bool callNative(NativeValue native, u8 argc);
+
+    // Coroutines
+    bool resumeCoroutine(CoroutineValue coroutine, u8 argc);
+    bool yieldCoroutine(Value value);
+    void leaveCoroutine(Value result);
+    void switchFiber(Fiber* target);
+    void saveFiber();
+    void loadFiber(Fiber* target);
+    bool growCoroutine();
+    void unwindFibers(Fiber* target);
     bool invoke(std::string methodName, u8 argc);
     bool invokeFromClass(ClassValue klass, std::string methodName, u8 argc);
     
+    // Modules
+    InterpreterResult importModule(const std::string &name, ModuleValue &module);
+    std::map<std::string, Value> &globalsOf(CallFrame* frame);
+    void releaseModules(const std::map<std::string, ModuleValue> &keep);
+
     // Value
     bool isFalsey(Value value);
     bool valuesEqual(Value valueA, Value valueB);
 
+    HeapOwner heap;
+    InterpreterLimits limits;
+    InterpreterResult limitResult;
+    bool limitReached = false;
+    std::chrono::steady_clock::time_point deadline;
+    u64 budgetRemaining;
+    i64 fuelSlice;
+    i64 fuel;
+    std::string errorMessage;
+    bool propagateRequested = false;
+
+    // Where an error raised in a nested run was raised, see captureTrace
+    std::string errorTrace;
+    int errorLine = 0;
+
+    // What's being thrown while the interpreter unwinds to a catch block
+    Value thrown;
+
     UpValuePtrValue openUpValues = NULL;
     std::map<std::string, Value> globals;
+    std::map<std::string, Value> snapshotGlobals;
 
+    // Imported modules by name, each is only run once per interpreter
+    std::map<std::string, ModuleValue> modules;
+    std::map<std::string, ModuleValue> snapshotModules;
+    std::vector<std::string> moduleDirectories;
+    bool moduleCache = false;
+    bool lazyCompile = false;
+
+    int nativeDepth = 0;
+    bool suspendRequested = false;
+    std::unique_ptr<EventLoop> loop;
+
+    // The running fiber's state, see Fiber
+    Fiber* fiber;
+    CallFrame* frames;
+    int framesMax;
     int frameCount;
-    CallFrame frames[FRAMES_MAX];
+    int frameHighWater;
 
+    Value* stack;
+    Value* stackLimit;
     Value* sp;
-    Value stack[STACK_MAX];
+    Value* stackHighWater;
+
+    Fiber mainFiber;
+    CallFrame mainFrames[FRAMES_MAX];
+    Value mainStack[STACK_MAX];
 };
 
 // Debug
@@ -0,0 +1,105 @@
+#pragma once
+#include <memory>
+#include <string>
+#include "interpreter.h"
+
+// Embedding API. Every VM owns its own interpreter (stack, globals, heap), so any number of
+// them can live in one process. Scripts are compiled once and functions they define are
+// called directly with C++ arguments, results come back as Values rather than through stdout.
+//
+//     jake::VM vm;
+//     vm.run("func area(w, h) { return w * h; }");
+//     jake::Value area = vm.get("area");
+//     jake::Value result;
+//     vm.call(area, result, 3, 4.5);
+//
+// Values the host gets from a VM may be kept after the VM is destroyed. What they hold stays
+// charged to the VM's heap account until the host drops them, see HeapOwner.
+
+namespace jake {
+
+    using ::Value;
+    using ::ValueType;
+    using Result = InterpreterResult;
+    using Limits = InterpreterLimits;
+
+    // Signature of natives registered with define, userData is whatever was passed to define
+    using Native = HostFn;
+
+    inline Value toValue(const Value &value) { return value; }
+    inline Value toValue(double value) { return NUMBER_VAL(value); }
+    inline Value toValue(int value) { return NUMBER_VAL((double) value); }
+    inline Value toValue(bool value) { return BOOLEAN_VAL(value); }
+    inline Value toValue(const char* value) { return std::string(value); }
+    inline Value toValue(const std::string &value) { return value; }
+
+    // A compiled script, can be run again without recompiling, on this or another VM
+    class Script {
+    public:
+        Script() = default;
+        explicit Script(FunctionValue function) : function(function) {};
+
+        bool valid() const { return function != nullptr; }
+
+        // After freezing, the script can be run on any number of VMs at once, one per thread
+        bool freeze() { return valid() && function->freeze(); }
+        bool frozen() const { return valid() && function->frozen; }
+
+    private:
+        friend class VM;
+        FunctionValue function;
+    };
+
+    class VM {
+    public:
+        VM();
+        ~VM();
+
+        VM(const VM&) = delete;
+        VM &operator=(const VM&) = delete;
+
+        Script compile(const std::string &source);
+        Result run(const Script &script);
+        Result run(const std::string &source);
+
+        // Calls any callable value (function, class, bound method, native)
+        template <typename... Args>
+        Result call(const Value &callee, Value &result, const Args&... args) {
+            Value argv[sizeof...(Args) + 1] = {toValue(args)...};
+            return interpreter->call(callee, argv, (int) sizeof...(Args), result);
+        }
+
+        // Returns None when the global is not defined
+        Value get(const std::string &name);
+        bool has(const std::string &name);
+        void set(const std::string &name, const Value &value);
+        void define(const std::string &name, Native function, void* userData = nullptr);
+
+        // Drops everything scripts defined since construction, see Interpreter::reset
+        void reset();
+        void setLimits(const Limits &limits);
+
+        // Where import looks for modules before JAKEPATH, and whether compiled modules are
+        // cached as .jakec files next to their source
+        void addModulePath(const std::string &directory);
+        void setModuleCache(bool enabled);
+
+        // Compiles function bodies on their first call, syntax errors in functions that never
+        // run go unreported
+        void setLazyCompile(bool enabled);
+
+        // Sends printed output to sink instead of stdout, spawned threads inherit it and may
+        // call it concurrently. nullptr restores stdout.
+        void setOutput(OutputSink sink, void* userData = nullptr);
+        void flush();
+
+        // Message of the last runtime error
+        const std::string &error();
+
+        Interpreter &raw();
+
+    private:
+        std::unique_ptr<Interpreter> interpreter;
+    };
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include "common.h"
+#include "value.h"
+
+// Keys are compared by value for numbers, strings, booleans and none, every other value by
+// identity. NaN is never equal to itself so it can't be a key.
+bool isHashable(const Value &key);
+u64 hashValue(const Value &key);
+bool keysEqual(const Value &a, const Value &b);
+
+// Hash map laid out like CPython's compact dict: entries are appended to a dense array in
+// insertion order and a separate open addressing table of 32 bit positions, probed linearly,
+// points into it. Iteration walks the dense array, lookups touch one small table and then
+// compare the stored hash before the key. Both arrays are charged to the heap account the map
+// was created with.
+class MapObj {
+public:
+    struct Entry {
+        Value key;
+        Value value;
+        u64 hash;
+        bool removed = false;
+    };
+
+    MapObj(HeapAccount* account);
+
+    // Callers check isHashable first
+    Value* find(const Value &key);
+    void set(const Value &key, Value value);
+    bool remove(const Value &key);
+
+    size_t size() { return count; }
+
+    // Iterate with: for (Entry &entry : map->entries) if (!entry.removed) ...
+    std::vector<Entry, AccountedAllocator<Entry>> entries;
+
+private:
+    static constexpr i32 EMPTY = -1;
+    static constexpr i32 DELETED = -2;
+
+    size_t slotFor(const Value &key, u64 hash);
+    void rebuild(size_t capacity);
+
+    std::vector<i32, AccountedAllocator<i32>> slots;
+    size_t count = 0;
+};
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "common.h"
+#include "value.h"
+
+#define MODULE_EXTENSION ".jake"
+#define COMPILED_MODULE_EXTENSION ".jakec"
+
+// A script loaded with import. Each module has its own globals, functions defined in it keep
+// using them wherever they're called from. Natives are copied in when the module is created.
+class ModuleObj {
+public:
+    std::string name;
+    std::string path;
+    std::map<std::string, Value> globals;
+
+    ModuleObj(std::string name, std::string path) : name(name), path(path) {};
+};
+
+// Path of name.jake in the first directory that has it, empty if none does
+std::string findModule(const std::vector<std::string> &directories, const std::string &name);
+
+// Directories listed in JAKEPATH, separated by ':'
+std::vector<std::string> environmentModulePaths();
+
+// Compiled modules are cached next to their source as name.jakec. A cache file is only used
+// while the source keeps the size and modification time it was compiled from, and only by a
+// build with the same bytecode format.
+FunctionValue loadCompiledModule(const std::string &sourcePath);
+bool saveCompiledModule(const std::string &sourcePath, FunctionValue function);
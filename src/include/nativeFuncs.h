@@ -8,10 +8,134 @@ namespace BuiltIn {
     Value nativeSqrt(int argc, Value argv[]);
     Value nativeClock(int argc, Value argv[]);
 
+    // Concurrency
+    Value nativeSpawn(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeJoin(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeChannel(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeSend(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeRecv(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+
+    // Coroutines
+    Value nativeCoroutine(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeDone(int argc, Value argv[]);
+
+    // Lists
+    Value nativePush(int argc, Value argv[]);
+    Value nativePop(int argc, Value argv[]);
+    Value nativeLen(int argc, Value argv[]);
+    Value nativeSlice(int argc, Value argv[]);
+
+    // Maps
+    Value nativeHas(int argc, Value argv[]);
+    Value nativeGet(int argc, Value argv[]);
+    Value nativeRemove(int argc, Value argv[]);
+    Value nativeKeys(int argc, Value argv[]);
+    Value nativeValues(int argc, Value argv[]);
+
+    // Typed arrays
+    Value nativeAdd(int argc, Value argv[]);
+    Value nativeMul(int argc, Value argv[]);
+    Value nativeScale(int argc, Value argv[]);
+    Value nativeDot(int argc, Value argv[]);
+    Value nativeSum(int argc, Value argv[]);
+    Value nativeMin(int argc, Value argv[]);
+    Value nativeMax(int argc, Value argv[]);
+    Value nativePrefixSum(int argc, Value argv[]);
+    Value nativeToList(int argc, Value argv[]);
+
+    // String builders
+    Value nativeAppend(int argc, Value argv[]);
+    Value nativeBuild(int argc, Value argv[]);
+
+    // Strings
+    Value nativeSubstring(int argc, Value argv[]);
+    Value nativeFind(int argc, Value argv[]);
+    Value nativeCharAt(int argc, Value argv[]);
+    Value nativeCharCode(int argc, Value argv[]);
+    Value nativeStr(int argc, Value argv[]);
+    Value nativeNum(int argc, Value argv[]);
+
+    // Files
+    Value nativeOpen(int argc, Value argv[]);
+    Value nativeReadLine(int argc, Value argv[]);
+    Value nativeClose(int argc, Value argv[]);
+    Value nativeMapFile(int argc, Value argv[]);
+    Value nativeReadAt(int argc, Value argv[]);
+    Value nativeFileSize(int argc, Value argv[]);
+
+    // Event loop, the I/O natives suspend the calling task when run from one
+    Value nativeAsync(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeWait(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeReadFile(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeWriteFile(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeSleep(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+
+    // Natives that create objects, charged to the interpreter's heap
+    Value nativeFloat64Array(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeInt32Array(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeStringBuilder(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+    Value nativeSplit(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+
+    // Output
+    Value nativeFlush(Interpreter &interpreter, void* userData, int argc, Value argv[]);
+
 }
 
-const std::map<std::string, NativeFn> nativeFunctions = {
+inline const std::map<std::string, NativeFn> nativeFunctions = {
     {"pow", &BuiltIn::nativePow},
     {"sqrt", &BuiltIn::nativeSqrt},
     {"clock", &BuiltIn::nativeClock},
+    {"done", &BuiltIn::nativeDone},
+    {"push", &BuiltIn::nativePush},
+    {"pop", &BuiltIn::nativePop},
+    {"len", &BuiltIn::nativeLen},
+    {"slice", &BuiltIn::nativeSlice},
+    {"has", &BuiltIn::nativeHas},
+    {"get", &BuiltIn::nativeGet},
+    {"remove", &BuiltIn::nativeRemove},
+    {"keys", &BuiltIn::nativeKeys},
+    {"values", &BuiltIn::nativeValues},
+    {"add", &BuiltIn::nativeAdd},
+    {"mul", &BuiltIn::nativeMul},
+    {"scale", &BuiltIn::nativeScale},
+    {"dot", &BuiltIn::nativeDot},
+    {"sum", &BuiltIn::nativeSum},
+    {"min", &BuiltIn::nativeMin},
+    {"max", &BuiltIn::nativeMax},
+    {"prefixSum", &BuiltIn::nativePrefixSum},
+    {"toList", &BuiltIn::nativeToList},
+    {"append", &BuiltIn::nativeAppend},
+    {"build", &BuiltIn::nativeBuild},
+    {"substring", &BuiltIn::nativeSubstring},
+    {"find", &BuiltIn::nativeFind},
+    {"charAt", &BuiltIn::nativeCharAt},
+    {"charCode", &BuiltIn::nativeCharCode},
+    {"str", &BuiltIn::nativeStr},
+    {"num", &BuiltIn::nativeNum},
+    {"open", &BuiltIn::nativeOpen},
+    {"readLine", &BuiltIn::nativeReadLine},
+    {"close", &BuiltIn::nativeClose},
+    {"mapFile", &BuiltIn::nativeMapFile},
+    {"readAt", &BuiltIn::nativeReadAt},
+    {"fileSize", &BuiltIn::nativeFileSize},
+};
+
+// Natives that need the interpreter calling them
+inline const std::map<std::string, HostFn> hostFunctions = {
+    {"spawn", &BuiltIn::nativeSpawn},
+    {"join", &BuiltIn::nativeJoin},
+    {"channel", &BuiltIn::nativeChannel},
+    {"send", &BuiltIn::nativeSend},
+    {"recv", &BuiltIn::nativeRecv},
+    {"coroutine", &BuiltIn::nativeCoroutine},
+    {"async", &BuiltIn::nativeAsync},
+    {"wait", &BuiltIn::nativeWait},
+    {"readFile", &BuiltIn::nativeReadFile},
+    {"writeFile", &BuiltIn::nativeWriteFile},
+    {"sleep", &BuiltIn::nativeSleep},
+    {"float64Array", &BuiltIn::nativeFloat64Array},
+    {"int32Array", &BuiltIn::nativeInt32Array},
+    {"stringBuilder", &BuiltIn::nativeStringBuilder},
+    {"split", &BuiltIn::nativeSplit},
+    {"flush", &BuiltIn::nativeFlush},
 };
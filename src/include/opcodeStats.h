@@ -0,0 +1,77 @@
+#pragma once
+#include <unordered_map>
+#include "common.h"
+#include "value.h"
+
+#define CYCLE_BUCKETS 16
+
+// Instrumentation for the interpreter loop, only compiled in with OPCODESTATS (JAKE_OPCODE_STATS).
+// Counts executions per opcode, per function and per bytecode offset. With OPCODECYCLES
+// (JAKE_OPCODE_CYCLES) the time between consecutive instructions is charged to the first of the
+// pair, measured with rdtsc where available, and kept as a log2 histogram per opcode.
+class OpcodeStats {
+public:
+    OpcodeStats();
+
+    inline void record(const FunctionValue &function, int offset, u8 opcode) {
+        opcodeCounts[opcode]++;
+
+        if (function.get() != lastFunction) {
+            lastFunction = function.get();
+            lastStats = &functionStats(function);
+        }
+
+        lastStats->total++;
+        lastStats->offsetCounts[offset]++;
+    }
+
+    inline void tick(u8 opcode) {
+        u64 now = readCycles();
+
+        if (hasPrevious) {
+            u64 cycles = now - previousTick;
+            opcodeCycles[previousOpcode] += cycles;
+            cycleHistogram[previousOpcode][bucketFor(cycles)]++;
+        }
+
+        hasPrevious = true;
+        previousTick = now;
+        previousOpcode = opcode;
+    }
+
+    // Called when the loop is left so the gap until the next run isn't charged to an instruction
+    void endRun();
+    void report(FILE* out);
+    void reset();
+
+private:
+    struct FunctionStats {
+        FunctionValue function;
+        u64 total = 0;
+        std::vector<u64> offsetCounts;
+    };
+
+    FunctionStats& functionStats(const FunctionValue &function);
+    static u64 readCycles();
+
+    static inline int bucketFor(u64 cycles) {
+        int bucket = 0;
+        while (cycles > 1 && bucket < CYCLE_BUCKETS - 1) {
+            cycles >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
+
+    u64 opcodeCounts[UINT8_COUNT];
+    u64 opcodeCycles[UINT8_COUNT];
+    u64 cycleHistogram[UINT8_COUNT][CYCLE_BUCKETS];
+
+    std::unordered_map<FunctionObj*, FunctionStats> functions;
+    FunctionObj* lastFunction;
+    FunctionStats* lastStats;
+
+    bool hasPrevious;
+    u64 previousTick;
+    u8 previousOpcode;
+};
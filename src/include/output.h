@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include "common.h"
+#include "value.h"
+
+#define OUTPUT_FLUSH_SIZE (1 << 16)
+
+// Receives flushed output instead of stdout, data is only valid for the duration of the call
+using OutputSink = void(*)(void* userData, const char* data, size_t length);
+
+// Appends the printed form of a value. Numbers use the shortest text that reads back as the
+// same double.
+void formatValue(std::string &out, const Value &value);
+void formatNumber(std::string &out, double number);
+
+// Output of print statements. Lines are collected in one buffer and handed to the sink in
+// large writes, only ever at line boundaries so output from several threads doesn't interleave
+// mid-line. A terminal on stdout is flushed every line like stdio would.
+class Output {
+public:
+    Output();
+    ~Output();
+
+    void setSink(OutputSink function, void* data);
+    OutputSink sink() { return sinkFunction; }
+    void* sinkData() { return sinkUserData; }
+
+    void writeLine(const Value &value);
+    void flush();
+
+private:
+    std::string buffer;
+    OutputSink sinkFunction = nullptr;
+    void* sinkUserData = nullptr;
+    bool lineBuffered = false;
+};
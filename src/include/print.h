@@ -1,11 +1,13 @@
 #include "interpreter.h"
+#include "output.h"
 
 inline void printToken(const Token &token) {
     static const char* names[] = {
         "LeftParen", "RightParen",
         "LeftBrace", "RightBrace",
+        "LeftBracket", "RightBracket",
         "Comma", "Dot", "Plus", "Minus",
-        "Slash", "Asterisk", "Semicolon",
+        "Slash", "Asterisk", "Semicolon", "Colon",
 
         "Bang", "BangEqual",
         "Equal", "EqualEqual",
@@ -14,7 +16,7 @@ inline void printToken(const Token &token) {
 
         "Identifier", "String", "Number",
         
-        "And", "Or", "If", "Else", "While", "For", "True", "False", "None", "Return", "Print", "Var", "Func", "Class", "This", "Super",
+        "And", "Or", "If", "Else", "While", "For", "True", "False", "None", "Return", "Print", "Var", "Func", "Class", "This", "Super", "Yield",
 
         "Error", "EndOfFile"
     };
@@ -29,68 +31,9 @@ inline void printToken(const Token &token) {
 
 
 inline void printValue(Value value) {
-    switch (value.type()) {
-        case ValueType::Number:
-            printf("%g", AS_NUMBER(value));
-            break;
-
-        case ValueType::Boolean:
-            if (AS_BOOLEAN(value))
-                printf("true");
-            else
-                printf("false");
-            break;
-
-        case ValueType::None:
-            printf("None");
-            break;
-
-        case ValueType::String:
-            printf("%s", AS_STRING(value).c_str());
-            break;
-        
-        case ValueType::Function:
-            if (!AS_FUNCTION(value)->name.size()) {
-                printf("<script>");
-            } else {
-                printf("<fn %s>", AS_FUNCTION(value)->name.c_str());
-            }
-            break;
-
-        case ValueType::Closure:
-            if (!AS_CLOSURE(value)->function->name.size()) {
-                printf("<script>");
-            } else {
-                printf("<fn %s>", AS_CLOSURE(value)->function->name.c_str());
-            }
-            break;
-
-        case ValueType::NativeFunc:
-            printf("<native fn>");
-            break;
-
-        case ValueType::UpValuePtr:
-            printf("<upvalue>");
-            break;
-
-        case ValueType::Class:
-            printf("<class %s>", AS_CLASS(value)->name.c_str());
-            break;
-
-        case ValueType::Instance:
-            printf("<%s instance>", AS_INSTANCE(value)->klass->name.c_str());
-            break;
-
-        case ValueType::BoundMethod:
-            if (!AS_BOUND_METHOD(value)->method->function->name.size()) {
-                printf("<bound script>");
-            } else {
-                printf("<bound fn %s>", AS_BOUND_METHOD(value)->method->function->name.c_str());
-            }
-
-        default:
-            break;
-    }
+    std::string text;
+    formatValue(text, value);
+    fwrite(text.data(), 1, text.size(), stdout);
 }
 
 inline int simpleInstruction(const char* name, int index) {
@@ -266,6 +209,34 @@ inline int disassembleInstruction(Chunk* chunk, int index) {
         case OpGetSuper:
             return constantInstruction("GetSuper", chunk, index);
 
+        case OpYield:
+            return simpleInstruction("Yield", index);
+
+        case OpBuildList:
+            return byteInstruction("BuildList", chunk, index);
+
+        case OpBuildMap:
+            return byteInstruction("BuildMap", chunk, index);
+
+        case OpIndexGet:
+            return simpleInstruction("IndexGet", index);
+
+        case OpIndexSet:
+            return simpleInstruction("IndexSet", index);
+
+        case OpAddAssign: {
+            u8 setOp = chunk->bytecode[index + 1];
+            u8 arg = chunk->bytecode[index + 2];
+            printf("%-16s %s %4d\n", "AddAssign", opcodeNames[setOp], arg);
+            return index + 3;
+        }
+
+        case OpImport:
+            return constantInstruction("Import", chunk, index);
+
+        case OpThrow:
+            return simpleInstruction("Throw", index);
+
         default:
             printf("Unknown Instruction\n");
             return index + 1;
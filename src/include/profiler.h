@@ -0,0 +1,60 @@
+#pragma once
+#include <memory>
+#include "common.h"
+#include "value.h"
+
+class Interpreter;
+
+struct ProfileFrame {
+    FunctionObj* function;
+    int offset;
+};
+
+// Signal-timer sampling profiler. The handler copies the interpreter's frames[] into
+// preallocated buffers, names and line numbers are only resolved when writing the report,
+// so nothing in the interpreter loop changes whether or not a profiler is attached.
+class Profiler {
+public:
+    Profiler(Interpreter* interpreter, int intervalMicroseconds = 1000, int maxFrames = 1 << 20);
+    ~Profiler();
+
+    bool start();
+    void stop();
+    bool writeCollapsed(const std::string &path);
+
+    int sampleCount() { return samples; }
+    int droppedCount() { return dropped; }
+
+private:
+    static void handleSignal(int signal);
+    void takeSample();
+
+    Interpreter* interpreter;
+    int intervalMicroseconds;
+    bool running = false;
+
+    int maxFrames;
+    int maxSamples;
+    std::unique_ptr<ProfileFrame[]> frameBuffer;
+    std::unique_ptr<int[]> sampleStarts;
+
+    volatile int framesUsed = 0;
+    volatile int samples = 0;
+    volatile int dropped = 0;
+};
+
+// Threads created while one of these is in scope start with the profiler's signal blocked.
+// ITIMER_PROF measures the whole process and the kernel hands SIGPROF to any thread that
+// doesn't block it, while the handler may only look at the profiled interpreter's thread.
+class ProfilerSignalBlock {
+public:
+    ProfilerSignalBlock();
+    ~ProfilerSignalBlock();
+
+    ProfilerSignalBlock(const ProfilerSignalBlock &) = delete;
+    ProfilerSignalBlock &operator=(const ProfilerSignalBlock &) = delete;
+
+private:
+    // Whether the signal has to be unblocked again, it may have been blocked already
+    bool unblock = false;
+};
@@ -5,8 +5,9 @@ enum class TokenType {
     // Single Char
     LeftParen, RightParen,
     LeftBrace, RightBrace,
+    LeftBracket, RightBracket,
     Comma, Dot, Plus, Minus,
-    Slash, Asterisk, Semicolon,
+    Slash, Asterisk, Semicolon, Colon,
 
     // One or Two Char
     Bang, BangEqual,
@@ -18,7 +19,7 @@ enum class TokenType {
     Identifier, String, Number,
     
     // keywords
-    And, Or, If, Else, While, For, True, False, None, Return, Print, Var, Func, Class, This, Super,
+    And, Or, If, Else, While, For, True, False, None, Return, Print, Var, Func, Class, This, Super, Yield, Import, Try, Catch, Throw,
 
     Error, EndOfFile
 };
@@ -36,10 +37,16 @@ public:
     int lineNumber;
     bool handledError;
 
+    // Off for passes that only look at the tokens, the parser reports errors when it scans again
+    bool reportErrors = true;
+
     Scanner() = default;
     Scanner(const char* source);
     Token scanToken();
 
+    // Continues scanning from position, which must be in the same source
+    void seek(const char* position, int line);
+
 private:
     char advance();
     char peek();
@@ -58,4 +65,5 @@ private:
     const char* start;
     const char* current;
     const char* source;
-};
\ No newline at end of file
+    const char* end;
+};
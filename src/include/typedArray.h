@@ -0,0 +1,56 @@
+#pragma once
+#include "common.h"
+#include "value.h"
+
+enum class ElementType {
+    Float64,
+    Int32
+};
+
+// Fixed length array of raw doubles or 32 bit integers, 8 or 4 bytes per element instead of a
+// whole Value. Storing a number into an Int32 array truncates it and wraps it to 32 bits.
+class TypedArrayObj {
+public:
+    ElementType elementType;
+    std::vector<double, AccountedAllocator<double>> float64;
+    std::vector<i32, AccountedAllocator<i32>> int32;
+
+    TypedArrayObj(ElementType elementType, size_t length, HeapAccount* account);
+
+    size_t length() { return elementType == ElementType::Float64 ? float64.size() : int32.size(); }
+    const char* typeName() { return elementType == ElementType::Float64 ? "Float64Array" : "Int32Array"; }
+
+    double get(size_t index) { return elementType == ElementType::Float64 ? float64[index] : (double) int32[index]; }
+    void set(size_t index, double value);
+};
+
+i32 toInt32(double value);
+
+// Bulk kernels behind the typed array natives, vectorized with AVX2 when the build targets it
+// (JAKE_NATIVE_ARCH), SSE2 otherwise on x86-64 and scalar everywhere else. Integer arithmetic
+// wraps, integer sums and dot products are exact up to 2^53. Floating point sums and dot
+// products use several accumulators, so they can round differently from a left to right loop.
+namespace Kernels {
+
+    void add(const double* a, const double* b, double* out, size_t count);
+    void add(const i32* a, const i32* b, i32* out, size_t count);
+    void mul(const double* a, const double* b, double* out, size_t count);
+    void mul(const i32* a, const i32* b, i32* out, size_t count);
+    void scale(const double* a, double factor, double* out, size_t count);
+    void scale(const i32* a, i32 factor, i32* out, size_t count);
+
+    double sum(const double* a, size_t count);
+    double sum(const i32* a, size_t count);
+    double dot(const double* a, const double* b, size_t count);
+    double dot(const i32* a, const i32* b, size_t count);
+
+    // count must be at least 1
+    double min(const double* a, size_t count);
+    double min(const i32* a, size_t count);
+    double max(const double* a, size_t count);
+    double max(const i32* a, size_t count);
+
+    void prefixSum(const double* a, double* out, size_t count);
+    void prefixSum(const i32* a, i32* out, size_t count);
+
+}
@@ -2,12 +2,16 @@
 #include <map>
 #include <variant>
 #include <memory>
+#include <string_view>
 #include "common.h"
 #include "jakelang.h"
+#include "heap.h"
 
 class Value;
+class Interpreter;
 
 typedef Value (*NativeFn)(int argc, Value argv[]);
+typedef Value (*HostFn)(Interpreter &interpreter, void* userData, int argc, Value argv[]);
 
 class StringObj;
 class FunctionObj;
@@ -17,11 +21,22 @@ class ExceptionObj;
 class ClassObj;
 class InstanceObj;
 class BoundMethod;
+class NativeObj;
+class ThreadObj;
+class ChannelObj;
+class CoroutineObj;
+class FileObj;
+class MappedFileObj;
+class ListObj;
+class MapObj;
+class TypedArrayObj;
+class StringBuilderObj;
+class ModuleObj;
+class LazyFunction;
 
 using NoneValue = std::monostate;
 using NumberValue = double;
 using BooleanValue = bool;
-using StringValue = std::string;
 using FunctionValue = std::shared_ptr<FunctionObj>;
 using UpValuePtrValue = std::shared_ptr<UpValueObj>;
 using ClosureValue = std::shared_ptr<ClosureObj>;
@@ -30,6 +45,54 @@ using ExceptionValue = std::shared_ptr<ExceptionObj>;
 using ClassValue = std::shared_ptr<ClassObj>;
 using InstanceValue = std::shared_ptr<InstanceObj>;
 using BoundMethodValue = std::shared_ptr<BoundMethod>;
+using NativeValue = std::shared_ptr<NativeObj>;
+using ThreadValue = std::shared_ptr<ThreadObj>;
+using ChannelValue = std::shared_ptr<ChannelObj>;
+using CoroutineValue = std::shared_ptr<CoroutineObj>;
+using FileValue = std::shared_ptr<FileObj>;
+using MappedFileValue = std::shared_ptr<MappedFileObj>;
+using ListValue = std::shared_ptr<ListObj>;
+using MapValue = std::shared_ptr<MapObj>;
+using TypedArrayValue = std::shared_ptr<TypedArrayObj>;
+using StringBuilderValue = std::shared_ptr<StringBuilderObj>;
+using ModuleValue = std::shared_ptr<ModuleObj>;
+
+using AccountedString = std::basic_string<char, std::char_traits<char>, CurrentAccountAllocator<char>>;
+
+// Script strings, their buffers are charged to the heap of the interpreter running on the
+// thread that allocates them, see CurrentAccountAllocator. Converts to and from std::string.
+class StringValue : public AccountedString {
+public:
+    using AccountedString::AccountedString;
+
+    StringValue() = default;
+    StringValue(const AccountedString &text) : AccountedString(text) {};
+    StringValue(AccountedString &&text) : AccountedString(std::move(text)) {};
+    StringValue(const std::string &text) : AccountedString(text.data(), text.size()) {};
+    StringValue(std::string_view text) : AccountedString(text.data(), text.size()) {};
+    StringValue(const char* text) : AccountedString(text) {};
+
+    operator std::string() const { return std::string(data(), size()); }
+};
+
+// Immutable text shared by every slice taken from it
+using SharedString = std::shared_ptr<const StringValue>;
+
+// View of part of a shared string. Slices are held inline in the Value like strings are, so
+// making one never allocates, it only keeps the parent alive. They read as ordinary strings
+// everywhere and are only copied out into a string when concatenated or stored as a map key.
+class StringSlice {
+public:
+    SharedString parent;
+    size_t offset = 0;
+    size_t length = 0;
+
+    StringSlice(SharedString parent, size_t offset, size_t length) : parent(std::move(parent)), offset(offset), length(length) {};
+
+    std::string_view view() const { return std::string_view(*parent).substr(offset, length); }
+};
+
+using StringSliceValue = StringSlice;
 
 enum class ValueType {
     None,
@@ -43,16 +106,28 @@ enum class ValueType {
     Exception,
     Class,
     Instance,
-    BoundMethod
+    BoundMethod,
+    Native,
+    Thread,
+    Channel,
+    Coroutine,
+    File,
+    MappedFile,
+    List,
+    Map,
+    TypedArray,
+    StringBuilder,
+    StringSlice,
+    Module
 };
 
-using ValueVariant = std::variant<NoneValue, NumberValue, BooleanValue, StringValue, FunctionValue, UpValuePtrValue, ClosureValue, NativeFuncValue, ExceptionValue, ClassValue, InstanceValue, BoundMethodValue>;
+using ValueVariant = std::variant<NoneValue, NumberValue, BooleanValue, StringValue, FunctionValue, UpValuePtrValue, ClosureValue, NativeFuncValue, ExceptionValue, ClassValue, InstanceValue, BoundMethodValue, NativeValue, ThreadValue, ChannelValue, CoroutineValue, FileValue, MappedFileValue, ListValue, MapValue, TypedArrayValue, StringBuilderValue, StringSliceValue, ModuleValue>;
 
 class Value : public ValueVariant {
 public:
     using ValueVariant::variant;
 
-    ValueType type() {
+    ValueType type() const {
         return (ValueType) index();
     }
 
@@ -62,12 +137,25 @@ public:
     }
 };
 
+// A try block covers bytecode [start, end). When something throws in that range the frame's
+// stack is cut back to stackDepth slots, the thrown value is pushed and execution continues at
+// handler, the start of the catch block.
+struct ExceptionHandler {
+    int start;
+    int end;
+    int handler;
+    int stackDepth;
+};
+
 class Chunk {
 public:
     std::vector<u8> bytecode;
     std::vector<Value> constants;
     std::map<int, int> lineNumbers;
 
+    // Innermost try blocks come first, nothing here is looked at until something throws
+    std::vector<ExceptionHandler> handlers;
+
     int addConstant(Value value);
     int getLineNumber(int bytecodeIndex);
 };
@@ -76,10 +164,19 @@ class FunctionObj {
 public:
     int argc = 0;
     int upValueCount = 0;
+    bool frozen = false;
     std::string name;
     Chunk chunk;
 
+    // Set while the body hasn't been compiled yet, see LazyFunction
+    std::shared_ptr<LazyFunction> lazy;
+
     FunctionObj() : chunk(Chunk()) {};
+
+    // Marks this function and every function in its constants as immutable so the tree can be
+    // shared between threads, each running it on its own Interpreter. Fails if a constant is
+    // not plain data (a runtime object would be shared along with the code).
+    bool freeze();
 };
 
 class UpValueObj {
@@ -97,6 +194,9 @@ public:
     FunctionValue function;
     std::vector<UpValuePtrValue> upValues;
 
+    // Whose globals the function uses, none for the main script's
+    ModuleValue module;
+
     ClosureObj() = default;
     ClosureObj(FunctionValue function);
 };
@@ -137,6 +237,40 @@ public:
     BoundMethod(ClosureValue method, Value receiver) : method(method), instance(receiver) {};
 };
 
+// Native registered by a host, carries the host's state and can call back into the interpreter
+class NativeObj {
+public:
+    std::string name;
+    HostFn function;
+    void* userData;
+
+    NativeObj() = default;
+    NativeObj(std::string name, HostFn function, void* userData) : name(name), function(function), userData(userData) {};
+};
+
+// Contiguous growable array. The element buffer is charged to the heap account of the list it
+// was created from, so a script can't grow a list past its interpreter's quota.
+using ValueList = std::vector<Value, AccountedAllocator<Value>>;
+
+class ListObj {
+public:
+    ValueList items;
+
+    ListObj(HeapAccount* account) : items(AccountedAllocator<Value>(account)) {};
+    ListObj(ValueList items) : items(std::move(items)) {};
+};
+
+// Mutable string for assembling text piece by piece, appends are amortized O(1) where
+// concatenating with + copies the whole string every time. Its buffer is heap accounted.
+using BuilderString = std::basic_string<char, std::char_traits<char>, AccountedAllocator<char>>;
+
+class StringBuilderObj {
+public:
+    BuilderString text;
+
+    StringBuilderObj(HeapAccount* account) : text(AccountedAllocator<char>(account)) {};
+};
+
 #define NUMBER_VAL(value) (value)
 #define BOOLEAN_VAL(value) (value)
 #define NONE_VAL() (std::monostate{})
@@ -157,6 +291,21 @@ public:
 #define IS_CLASS(value) ((value).type() == ValueType::Class)
 #define IS_INSTANCE(value) ((value).type() == ValueType::Instance)
 #define IS_BOUND_METHOD(value) ((value).type() == ValueType::Instance)
+#define IS_NATIVE(value) ((value).type() == ValueType::Native)
+#define IS_THREAD(value) ((value).type() == ValueType::Thread)
+#define IS_CHANNEL(value) ((value).type() == ValueType::Channel)
+#define IS_COROUTINE(value) ((value).type() == ValueType::Coroutine)
+#define IS_FILE(value) ((value).type() == ValueType::File)
+#define IS_MAPPED_FILE(value) ((value).type() == ValueType::MappedFile)
+#define IS_LIST(value) ((value).type() == ValueType::List)
+#define IS_MAP(value) ((value).type() == ValueType::Map)
+#define IS_TYPED_ARRAY(value) ((value).type() == ValueType::TypedArray)
+#define IS_STRING_BUILDER(value) ((value).type() == ValueType::StringBuilder)
+#define IS_STRING_SLICE(value) ((value).type() == ValueType::StringSlice)
+#define IS_MODULE(value) ((value).type() == ValueType::Module)
+
+// Strings or string slices, anything textOf can read
+#define IS_TEXT(value) (IS_STRING(value) || IS_STRING_SLICE(value))
 
 #define AS_STRING(obj) (std::get<StringValue>(obj))
 #define AS_FUNCTION(obj) (std::get<FunctionValue>(obj))
@@ -167,3 +316,19 @@ public:
 #define AS_CLASS(obj) (std::get<ClassValue>(obj))
 #define AS_INSTANCE(obj) (std::get<InstanceValue>(obj))
 #define AS_BOUND_METHOD(obj) (std::get<BoundMethodValue>(obj))
+#define AS_NATIVE(obj) (std::get<NativeValue>(obj))
+#define AS_THREAD(obj) (std::get<ThreadValue>(obj))
+#define AS_CHANNEL(obj) (std::get<ChannelValue>(obj))
+#define AS_COROUTINE(obj) (std::get<CoroutineValue>(obj))
+#define AS_FILE(obj) (std::get<FileValue>(obj))
+#define AS_MAPPED_FILE(obj) (std::get<MappedFileValue>(obj))
+#define AS_LIST(obj) (std::get<ListValue>(obj))
+#define AS_MAP(obj) (std::get<MapValue>(obj))
+#define AS_TYPED_ARRAY(obj) (std::get<TypedArrayValue>(obj))
+#define AS_STRING_BUILDER(obj) (std::get<StringBuilderValue>(obj))
+#define AS_STRING_SLICE(obj) (std::get<StringSliceValue>(obj))
+#define AS_MODULE(obj) (std::get<ModuleValue>(obj))
+
+inline std::string_view textOf(const Value &value) {
+    return IS_STRING(value) ? std::string_view(AS_STRING(value)) : AS_STRING_SLICE(value).view();
+}
@@ -1,44 +1,402 @@
+#include <atomic>
 #include <cmath>
+#include <fstream>
+#include <sstream>
 #include "interpreter.h"
 #include "compiler.h"
 #include "benchmark.h"
 #include "print.h"
+#include "eventLoop.h"
+#include "map.h"
+#include "typedArray.h"
+#include "module.h"
+
+// Coroutine
+
+void CoroutineObj::allocate() {
+    framesCapacity = COROUTINE_FRAMES_START;
+    stackCapacity = COROUTINE_STACK_START;
+    frames = std::make_unique<CallFrame[]>(framesCapacity);
+    stack = std::make_unique<Value[]>(stackCapacity);
+    account->charge(footprint());
+
+    fiber.frames = frames.get();
+    fiber.framesMax = framesCapacity;
+    fiber.stack = stack.get();
+    fiber.stackLimit = stack.get() + stackCapacity;
+    fiber.sp = fiber.stackHighWater = stack.get();
+    fiber.coroutine = this;
+}
+
+// Moves the fiber to arrays twice the size, false once it's as large as the main fiber. Slots,
+// the stack pointers and open upvalues are rebased, so nothing else may point into the old
+// stack, see Interpreter::growCoroutine.
+bool CoroutineObj::grow() {
+    int newFramesCapacity = std::min(framesCapacity * 2, FRAMES_MAX);
+    int newStackCapacity = std::min(stackCapacity * 2, STACK_MAX);
+
+    if (newFramesCapacity == framesCapacity && newStackCapacity == stackCapacity)
+        return false;
+
+    std::unique_ptr<CallFrame[]> newFrames = std::make_unique<CallFrame[]>(newFramesCapacity);
+    std::unique_ptr<Value[]> newStack = std::make_unique<Value[]>(newStackCapacity);
+    Value* oldStack = stack.get();
+    Value* top = std::max(fiber.sp, fiber.stackHighWater);
+
+    for (Value* slot = oldStack; slot < top; slot++)
+        newStack[slot - oldStack] = std::move(*slot);
+
+    for (int index = 0; index < fiber.frameCount; index++) {
+        newFrames[index] = std::move(frames[index]);
+        newFrames[index].slots = newStack.get() + (newFrames[index].slots - oldStack);
+    }
+
+    for (UpValueObj* upValue = fiber.openUpValues.get(); upValue != nullptr; upValue = upValue->next.get())
+        upValue->location = newStack.get() + (upValue->location - oldStack);
+
+    fiber.sp = newStack.get() + (fiber.sp - oldStack);
+    fiber.stackHighWater = newStack.get() + (top - oldStack);
+
+    account->release(footprint());
+    framesCapacity = newFramesCapacity;
+    stackCapacity = newStackCapacity;
+    account->charge(footprint());
+
+    frames = std::move(newFrames);
+    stack = std::move(newStack);
+
+    fiber.frames = frames.get();
+    fiber.framesMax = framesCapacity;
+    fiber.stack = stack.get();
+    fiber.stackLimit = stack.get() + stackCapacity;
+    return true;
+}
+
+void CoroutineObj::release() {
+    if (stack == nullptr)
+        return;
+
+    // Closures that escaped while this was suspended still point into the stack
+    while (fiber.openUpValues != NULL) {
+        UpValuePtrValue upValue = fiber.openUpValues;
+        upValue->closed = *upValue->location;
+        upValue->location = &upValue->closed;
+        fiber.openUpValues = upValue->next;
+    }
+
+    account->release(footprint());
+
+    // The stack may hold the last reference to this coroutine, don't touch members after this
+    std::unique_ptr<CallFrame[]> oldFrames = std::move(frames);
+    std::unique_ptr<Value[]> oldStack = std::move(stack);
+}
+
+CoroutineObj::~CoroutineObj() {
+    release();
+}
 
 // Interpreter
 
 Interpreter::Interpreter() {
+    heap->interrupt = &fuel;
+
+    mainFiber.frames = frames = mainFrames;
+    mainFiber.framesMax = framesMax = FRAMES_MAX;
+    mainFiber.stack = stack = mainStack;
+    mainFiber.stackLimit = stackLimit = mainStack + STACK_MAX;
+    fiber = &mainFiber;
+    stackHighWater = stack;
+    frameHighWater = 0;
+    resetStack();
+
     for (auto &[name, funcPtr] : nativeFunctions) {
         defineNative(name, funcPtr);
     }
+
+    for (auto &[name, funcPtr] : hostFunctions) {
+        defineNative(name, funcPtr, nullptr);
+    }
+
+    snapshot();
+}
+
+Interpreter::~Interpreter() {
+    releaseModules({});
+}
+
+void Interpreter::snapshot() {
+    snapshotGlobals = globals;
+    snapshotModules = modules;
+}
+
+// Only the slots a script could have written are cleared: values are moved out when popped,
+// so anything still referenced lies below the highest sp seen when frames or natives returned.
+void Interpreter::reset() {
+    unwindFibers(&mainFiber);
+    loop.reset();
+    globals = snapshotGlobals;
+    releaseModules(snapshotModules);
+    modules = snapshotModules;
+    openUpValues = NULL;
+
+    resetStack();
+    for (Value* slot = stack; slot < stackHighWater; slot++)
+        *slot = NONE_VAL();
+
+    for (int index = 0; index < frameHighWater; index++)
+        frames[index] = CallFrame();
+
+    stackHighWater = stack;
+    frameHighWater = 0;
+
+    heap->exceeded = false;
 }
 
 InterpreterResult Interpreter::interpret(const char* source) {
-    Parser parser = Parser(source);
-    FunctionValue function = parser.compile();
+    FunctionValue function = compile(source);
 
     if (function == nullptr)
         return InterpreterResult::Error;
 
+    return execute(function);
+}
+
+FunctionValue Interpreter::compile(const char* source, bool echoResult) {
+    Parser parser = Parser(source, lazyCompile);
+    FunctionValue function = parser.compile(echoResult);
+
+    if (function == nullptr)
+        errorMessage = "Compile error";
+
+    return function;
+}
+
+InterpreterResult Interpreter::execute(FunctionValue function) {
+    HeapScope charged(heap.get());
+
     resetStack();
-    ClosureValue closure = std::make_shared<ClosureObj>(function);
+    openUpValues = NULL;
+
+    startLimits();
 
-    frames[frameCount++] = CallFrame(closure, stack);
+    ClosureValue closure = allocate<ClosureObj>(function);
+
+    frames[frameCount] = CallFrame(closure, stack);
+    std::atomic_signal_fence(std::memory_order_release);
+    frameCount++;
+    frameHighWater = std::max(frameHighWater, frameCount);
 
     push(closure);
 
-    InterpreterResult result = run();
+    InterpreterResult result = run(0, fiber);
+
+    // The script's return value is left where its closure was
+    if (result == InterpreterResult::Success)
+        pop();
+
+    #ifdef OPCODECYCLES
+        opcodeStats.endRun();
+    #endif
 
     #ifdef DEBUGINFO
         printStack(stack, sp);
         printGlobals(globals);
     #endif
 
+    // Leave the interpreter callable after a failed script
+    if (result != InterpreterResult::Success) {
+        unwindFibers(&mainFiber);
+        closeUpValues(stack);
+        resetStack();
+    }
+
+    output.flush();
     return result;
 }
 
+InterpreterResult Interpreter::call(Value callee, const Value* args, int argc, Value &result) {
+    if (argc > UINT8_MAX || sp + argc + 1 > stackLimit) {
+        errorMessage = "Too many arguments";
+        return InterpreterResult::Error;
+    }
+
+    HeapScope charged(heap.get());
+
+    // Only the outermost call starts the limits, nested calls share them with their caller
+    if (frameCount == 0)
+        startLimits();
+
+    errorMessage.clear();
+
+    Value* base = sp;
+    int baseFrame = frameCount;
+    Fiber* baseFiber = fiber;
+
+    push(callee);
+    for (int index = 0; index < argc; index++)
+        push(args[index]);
+
+    InterpreterResult status = InterpreterResult::Success;
+
+    nativeDepth++;
+
+    if (!callValue(callee, (u8) argc)) {
+        if (isOutermost(baseFrame, baseFiber))
+            reportError();
+
+        status = InterpreterResult::Error;
+    } else if (fiber != baseFiber || frameCount > baseFrame) {
+        status = run(baseFrame, baseFiber);
+    }
+
+    nativeDepth--;
+
+    if (status == InterpreterResult::Success) {
+        result = pop();
+    } else {
+        unwindFibers(baseFiber);
+        closeUpValues(base);
+        stackHighWater = std::max(stackHighWater, sp);
+        frameCount = baseFrame;
+        sp = base;
+    }
+
+    // The host gets control back, show what the call printed
+    if (frameCount == 0)
+        output.flush();
+
+    return status;
+}
+
+bool Interpreter::getGlobal(const std::string &name, Value &value) {
+    auto global = globals.find(name);
+
+    if (global == globals.end())
+        return false;
+
+    value = global->second;
+    return true;
+}
+
+void Interpreter::setGlobal(const std::string &name, Value value) {
+    globals[name] = value;
+}
+
+const std::map<std::string, Value> &Interpreter::globalTable() {
+    return globals;
+}
+
+const std::string &Interpreter::lastError() {
+    return errorMessage;
+}
+
+CoroutineValue Interpreter::makeCoroutine(ClosureValue closure) {
+    return allocate<CoroutineObj>(closure, heap.get());
+}
+
+void Interpreter::suspend() {
+    suspendRequested = true;
+}
+
+EventLoop &Interpreter::eventLoop() {
+    if (loop == nullptr)
+        loop = std::make_unique<EventLoop>();
+
+    return *loop;
+}
+
+void Interpreter::addModulePath(const std::string &directory) {
+    moduleDirectories.push_back(directory);
+}
+
+const std::vector<std::string> &Interpreter::modulePaths() {
+    return moduleDirectories;
+}
+
+void Interpreter::setModuleCache(bool enabled) {
+    moduleCache = enabled;
+}
+
+void Interpreter::setLazyCompile(bool enabled) {
+    lazyCompile = enabled;
+}
+
+void Interpreter::setLimits(InterpreterLimits newLimits) {
+    limits = newLimits;
+    heap->limit = limits.heapBytes;
+}
+
+const InterpreterLimits &Interpreter::getLimits() {
+    return limits;
+}
+
+size_t Interpreter::heapBytes() {
+    return heap->bytes + heap->shared->load(std::memory_order_relaxed);
+}
+
+HeapAccount* Interpreter::heapAccount() {
+    return heap.get();
+}
+
+void Interpreter::startLimits() {
+    heap->exceeded = false;
+    limitReached = false;
+    errorMessage.clear();
+    budgetRemaining = limits.instructionBudget ? limits.instructionBudget : UINT64_MAX;
+    deadline = std::chrono::steady_clock::now() + limits.timeout;
+    refillFuel();
+}
+
+// Fuel is the part of the instruction budget handed to the loop at a time, so the hot path
+// only decrements and tests it. Running out of a slice is where the deadline gets checked.
+void Interpreter::refillFuel() {
+    fuelSlice = (i64) std::min<u64>(budgetRemaining, FUEL_SLICE);
+    fuel = fuelSlice;
+}
+
+bool Interpreter::checkLimits() {
+    if (heap->exceeded)
+        return stopForLimit(InterpreterResult::MemoryLimit, "Heap quota exceeded");
+
+    u64 consumed = (u64) (fuelSlice - fuel);
+
+    if (limits.instructionBudget && consumed >= budgetRemaining) {
+        budgetRemaining = 0;
+        return stopForLimit(InterpreterResult::InstructionLimit, "Instruction budget exhausted");
+    }
+
+    budgetRemaining -= std::min(consumed, budgetRemaining);
+
+    if (limits.timeout.count() && std::chrono::steady_clock::now() >= deadline)
+        return stopForLimit(InterpreterResult::Timeout, "Script timed out");
+
+    refillFuel();
+    return true;
+}
+
+// Runs that get an error back from a native stop with the limit's result instead of trying to
+// catch the error, so a limit hit in a nested call() or a blocking native ends the script
+bool Interpreter::stopForLimit(InterpreterResult result, const char* msg) {
+    limitResult = result;
+    limitReached = true;
+    fatalError(msg);
+    return false;
+}
+
+bool Interpreter::timedOut() {
+    if (limitReached)
+        return true;
+
+    if (!limits.timeout.count() || std::chrono::steady_clock::now() < deadline)
+        return false;
+
+    return !stopForLimit(InterpreterResult::Timeout, "Script timed out");
+}
+
+// Moving out leaves nothing referenced above sp, see reset()
 Value Interpreter::pop() {
     sp--;
-    return *sp;
+    return std::move(*sp);
 }
 
 Value Interpreter::peek(int offset) {
@@ -58,7 +416,7 @@ UpValuePtrValue Interpreter::captureUpvalue(Value* local) {
         return upValue;
     }
 
-    UpValuePtrValue createdUpValue = std::make_shared<UpValueObj>(local);
+    UpValuePtrValue createdUpValue = allocate<UpValueObj>(local);
 
     createdUpValue->next = upValue;
 
@@ -77,29 +435,130 @@ void Interpreter::push(Value value) {
 }
 
 void Interpreter::runtimeError(std::string msg) {
+    errorMessage = msg;
+    errorTrace.clear();
+    thrown = allocate<ExceptionObj>(msg, ExceptionType::RuntimeError);
+}
 
-    CallFrame* frame = &frames[frameCount - 1];
-    int index = (int) (frame->ip - frame->closure->function->chunk.bytecode.data());
-    
-    printError(ExceptionType::RuntimeError, msg.c_str(), frame->closure->function->chunk.getLineNumber(index));
+void Interpreter::fatalError(std::string msg) {
+    errorMessage = msg;
+    errorTrace.clear();
+    reportError();
+}
+
+// Prints the error with the frames it was raised in, which may be gone by now if it came out
+// of a nested run, see captureTrace
+void Interpreter::reportError() {
+    output.flush();
+
+    if (errorTrace.empty())
+        captureTrace();
+
+    // A host calling a native directly has no frame to point at
+    if (errorTrace.empty()) {
+        printError(ExceptionType::RuntimeError, errorMessage.c_str());
+        return;
+    }
+
+    printError(ExceptionType::RuntimeError, errorMessage.c_str(), errorLine);
+    fputs(errorTrace.c_str(), stdout);
+    errorTrace.clear();
+}
+
+// Records where the error is being raised from the running fiber's frames. Called before a
+// nested run hands an uncaught error back, its frames are unwound before anything reports it.
+void Interpreter::captureTrace() {
+    if (frameCount == 0)
+        return;
+
+    CallFrame* top = &frames[frameCount - 1];
+    errorLine = top->closure->function->chunk.getLineNumber((int) (top->ip - top->closure->function->chunk.bytecode.data()));
 
     for (int i = frameCount - 1; i >= 0; i--) {
         CallFrame* frame = &frames[i];
         FunctionValue function = frame->closure->function;
         
         int instruction = (frame->ip - function->chunk.bytecode.data() - 1);
-        printf("[line %d] in ", function->chunk.getLineNumber(instruction));  // TODO: Make better errors
+        errorTrace += formatStr("[line %d] in ", function->chunk.getLineNumber(instruction));  // TODO: Make better errors
         
         if (!function->name.size()) {
-            printf("script\n");
+            errorTrace += "script\n";
         } else {
-            printf("%s()\n", function->name.c_str());
+            errorTrace += function->name + "()\n";
+        }
+    }
+}
+
+// Looks for the innermost try block around where each frame is, from the top frame down and
+// on through the fibers that resumed the running coroutine. Frames below baseFrame belong to
+// a run further out, past a native's C++ frame, the error is handed back to that run instead
+// with thrown kept, only the outermost run reports it. Frames and coroutines above the
+// handler are dropped and their upvalues closed.
+bool Interpreter::catchError(int baseFrame, Fiber* baseFiber) {
+    Fiber* target = fiber;
+    CallFrame* targetFrames = frames;
+    int count = frameCount;
+
+    for (;;) {
+        int lowest = target == baseFiber ? baseFrame : 0;
+
+        for (int index = count - 1; index >= lowest; index--) {
+            CallFrame* frame = &targetFrames[index];
+            Chunk &chunk = frame->closure->function->chunk;
+            int offset = (int) (frame->ip - chunk.bytecode.data() - 1);
+
+            for (ExceptionHandler &handler : chunk.handlers) {
+                if (offset < handler.start || offset >= handler.end)
+                    continue;
+
+                unwindFibers(target);
+                frameCount = index + 1;
+
+                Value* base = frame->slots + handler.stackDepth;
+                closeUpValues(base);
+                stackHighWater = std::max(stackHighWater, sp);
+                sp = base;
+
+                frame->ip = chunk.bytecode.data() + handler.handler;
+                push(std::move(thrown));
+                thrown = NONE_VAL();
+                errorTrace.clear();
+                return true;
+            }
         }
+
+        if (target == baseFiber || target->coroutine == nullptr || target->resumer == nullptr)
+            break;
+
+        target = target->resumer;
+        targetFrames = target->frames;
+        count = target->frameCount;
     }
 
+    if (isOutermost(baseFrame, baseFiber)) {
+        reportError();
+        thrown = NONE_VAL();
+    } else if (errorTrace.empty()) {
+        captureTrace();
+    }
+
+    return false;
+}
+
+// No script frames below, nothing further out could catch an error
+bool Interpreter::isOutermost(int baseFrame, Fiber* baseFiber) {
+    return baseFrame == 0 && baseFiber == &mainFiber;
+}
+
+Value Interpreter::propagateError() {
+    propagateRequested = true;
+    return allocate<ExceptionObj>(errorMessage, ExceptionType::RuntimeError);
 }
 
+
 void Interpreter::resetStack() {
+    stackHighWater = std::max(stackHighWater, sp);
+    frameHighWater = std::max(frameHighWater, frameCount);
     sp = stack;
     frameCount = 0;
 }
@@ -121,6 +580,11 @@ void Interpreter::defineNative(std::string name, NativeFn function) {
     globals[name] = function;
 }
 
+// Host natives are part of the pristine state, so they survive reset()
+void Interpreter::defineNative(std::string name, HostFn function, void* userData) {
+    globals[name] = snapshotGlobals[name] = allocate<NativeObj>(name, function, userData);
+}
+
 void Interpreter::defineMethod(std::string name) {
     Value method = peek(0);
     ClassValue klass = AS_CLASS(peek(1));
@@ -138,12 +602,20 @@ bool Interpreter::callValue(Value value, u8 argc) {
             return callNativeFunction(AS_NATIVE_FUNCTION(value), argc);
         }
 
+        case ValueType::Native: {
+            return callNative(AS_NATIVE(value), argc);
+        }
+
+        case ValueType::Coroutine: {
+            return resumeCoroutine(AS_COROUTINE(value), argc);
+        }
+
         case ValueType::Class: {
             ClassValue klass = AS_CLASS(value);
-            sp[-argc - 1] = std::make_shared<InstanceObj>(klass);
+            sp[-argc - 1] = allocate<InstanceObj>(klass);
             auto initializer = klass->methods.find(constructorName);
             if (initializer != klass->methods.end()) {
-                callClosure(AS_CLOSURE(initializer->second), argc);
+                return callClosure(AS_CLOSURE(initializer->second), argc);
             } else if (argc != 0) {
                 runtimeError(formatStr("Expected 0 arguments got %d", argc));
                 return false;
@@ -158,6 +630,7 @@ bool Interpreter::callValue(Value value, u8 argc) {
         }
 
         default:
+            runtimeError("Invalid call target");
             return false;
     }
 
@@ -165,18 +638,37 @@ bool Interpreter::callValue(Value value, u8 argc) {
 }
 
 bool Interpreter::callClosure(ClosureValue closure, u8 argc) {
-    if (frameCount + 1 > FRAMES_MAX) {
-        runtimeError("Stack overflow");
-        return false;
+    // A frame can address UINT8_COUNT slots from its base, which has to fit on the stack
+    while (frameCount + 1 > framesMax || sp + UINT8_COUNT > stackLimit) {
+        if (!growCoroutine()) {
+            runtimeError("Stack overflow");
+            return false;
+        }
     }
 
     if (closure->function->argc != argc) {
         runtimeError(formatStr("Expcted %d arguments, got %d", closure->function->argc, argc));
         return false;
     }
+
+    // The syntax error becomes part of the runtime error, so a try block around the call
+    // catches it like anything else the call raises
+    if (closure->function->lazy != nullptr) {
+        std::string syntaxError;
+
+        if (!compileLazyFunction(closure->function.get(), syntaxError)) {
+            runtimeError(formatStr("Could not compile function %s: %s", closure->function->name.c_str(), syntaxError.c_str()));
+            return false;
+        }
+    }
     
-    frameCount++;
     frames[frameCount] = CallFrame(closure, sp - argc - 1);
+    fuel -= (i64) closure->function->chunk.bytecode.size();
+
+    // The profiler samples frames[0, frameCount) from a signal handler, publish the frame first
+    std::atomic_signal_fence(std::memory_order_release);
+    frameCount++;
+    frameHighWater = std::max(frameHighWater, frameCount);
 
     return true;
 }
@@ -190,13 +682,205 @@ bool Interpreter::callNativeFunction(NativeFuncValue nativeFunc, u8 argc) {
         return false;
     }
     
+    stackHighWater = std::max(stackHighWater, sp);
     sp -= argc + 1;
     push(result);
     return true;
 }
 
+// Unlike plain natives these may re-enter the interpreter through call(), which pushes above
+// the arguments, so the frame pointer has to be reloaded by the caller afterwards
+bool Interpreter::callNative(NativeValue native, u8 argc) {
+    Value* args = sp - argc;
+    Value result = native->function(*this, native->userData, argc, args);
+
+    bool propagate = propagateRequested;
+    propagateRequested = false;
+
+    if (IS_EXCEPTION(result)) {
+        suspendRequested = false;
+
+        // A failed call() left what it threw in thrown, it's raised here as it was
+        if (!propagate || IS_NONE(thrown))
+            runtimeError(AS_EXCEPTION(result)->msg.c_str());
+
+        return false;
+    }
+
+    stackHighWater = std::max(stackHighWater, sp);
+    sp = args - 1;
+
+    // The value the coroutine is resumed with becomes the native's result
+    if (suspendRequested) {
+        suspendRequested = false;
+        return yieldCoroutine(NONE_VAL());
+    }
+
+    push(result);
+    return true;
+}
+
+// Coroutines
+
+// The coroutine stays in the resumer's stack slot while it runs, which keeps it alive, and is
+// replaced by the value it yields or returns
+bool Interpreter::resumeCoroutine(CoroutineValue coroutine, u8 argc) {
+    bool fresh = coroutine->state == CoroutineState::Fresh;
+
+    if (coroutine->state == CoroutineState::Running) {
+        runtimeError("Coroutine is already running");
+        return false;
+    } else if (coroutine->state == CoroutineState::Done) {
+        runtimeError("Cannot resume a finished coroutine");
+        return false;
+    } else if (fresh && coroutine->closure->function->argc != argc) {
+        runtimeError(formatStr("Expcted %d arguments, got %d", coroutine->closure->function->argc, argc));
+        return false;
+    } else if (!fresh && argc > 1) {
+        runtimeError("Can only pass one value when resuming a coroutine");
+        return false;
+    }
+
+    Value* args = sp - argc;
+    stackHighWater = std::max(stackHighWater, sp);
+    sp = args;
+
+    if (fresh)
+        coroutine->allocate();
+
+    coroutine->state = CoroutineState::Running;
+    coroutine->nativeDepth = nativeDepth;
+    coroutine->fiber.resumer = fiber;
+    switchFiber(&coroutine->fiber);
+
+    if (fresh) {
+        push(coroutine->closure);
+        for (int index = 0; index < argc; index++)
+            push(std::move(args[index]));
+        return callClosure(coroutine->closure, argc);
+    }
+
+    // The resumed yield evaluates to the value passed in, an exception is raised instead
+    push(argc ? std::move(args[0]) : NONE_VAL());
+
+    if (IS_EXCEPTION(peek(0))) {
+        runtimeError(AS_EXCEPTION(peek(0))->msg);
+        thrown = peek(0);
+        return false;
+    }
+
+    return true;
+}
+
+bool Interpreter::yieldCoroutine(Value value) {
+    CoroutineObj* coroutine = fiber->coroutine;
+
+    if (coroutine == nullptr) {
+        runtimeError("Can only yield inside a coroutine");
+        return false;
+    }
+
+    if (coroutine->nativeDepth != nativeDepth) {
+        runtimeError("Cannot yield across a native call");
+        return false;
+    }
+
+    coroutine->state = CoroutineState::Suspended;
+    leaveCoroutine(std::move(value));
+    return true;
+}
+
+void Interpreter::leaveCoroutine(Value result) {
+    CoroutineObj* coroutine = fiber->coroutine;
+    Fiber* resumer = fiber->resumer;
+    fiber->resumer = nullptr;
+    switchFiber(resumer);
+
+    if (coroutine->state == CoroutineState::Done)
+        coroutine->release();
+
+    // Replacing the coroutine's slot may drop the last reference to it
+    sp[-1] = std::move(result);
+}
+
+void Interpreter::switchFiber(Fiber* target) {
+    saveFiber();
+    loadFiber(target);
+}
+
+// The profiler reads frames[0, frameCount) from a signal handler, never let it see the old
+// count with new frames: the count is zero from saveFiber until loadFiber is done
+void Interpreter::saveFiber() {
+    fiber->frameCount = frameCount;
+    fiber->frameHighWater = frameHighWater;
+    fiber->sp = sp;
+    fiber->stackHighWater = stackHighWater;
+    fiber->openUpValues = std::move(openUpValues);
+
+    frameCount = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+void Interpreter::loadFiber(Fiber* target) {
+    fiber = target;
+    frames = target->frames;
+    framesMax = target->framesMax;
+    frameHighWater = target->frameHighWater;
+    stack = target->stack;
+    stackLimit = target->stackLimit;
+    sp = target->sp;
+    stackHighWater = target->stackHighWater;
+    openUpValues = std::move(target->openUpValues);
+
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    frameCount = target->frameCount;
+}
+
+// Only while no native's C++ frame sits between the coroutine's resume and now, a native may
+// hold pointers into the stack, like its arguments, that growing would leave dangling
+bool Interpreter::growCoroutine() {
+    CoroutineObj* coroutine = fiber->coroutine;
+
+    if (coroutine == nullptr || coroutine->nativeDepth != nativeDepth)
+        return false;
+
+    saveFiber();
+    bool grown = coroutine->grow();
+    loadFiber(fiber);
+
+    return grown;
+}
+
+// After an error, abandons every coroutine between the running fiber and target
+void Interpreter::unwindFibers(Fiber* target) {
+    while (fiber != target && fiber->resumer != nullptr) {
+        CoroutineObj* coroutine = fiber->coroutine;
+        closeUpValues(stack);
+        coroutine->state = CoroutineState::Done;
+
+        Fiber* resumer = fiber->resumer;
+        fiber->resumer = nullptr;
+        switchFiber(resumer);
+        coroutine->release();
+    }
+}
+
 bool Interpreter::invoke(std::string methodName, u8 argc) {
-    Value value = AS_INSTANCE(peek(argc));
+    Value value = peek(argc);
+
+    // module.function(args) calls the module's global in place of the receiver
+    if (IS_MODULE(value)) {
+        ModuleValue module = AS_MODULE(value);
+        auto member = module->globals.find(methodName);
+
+        if (member == module->globals.end()) {
+            runtimeError(formatStr("Module %s has no member %s", module->name.c_str(), methodName.c_str()));
+            return false;
+        }
+
+        sp[-argc - 1] = member->second;
+        return callValue(member->second, argc);
+    }
 
     if (!IS_INSTANCE(value)) {
         runtimeError("Only instances have methods");
@@ -209,7 +893,7 @@ bool Interpreter::invoke(std::string methodName, u8 argc) {
 
     if (field != instance->fields.end()) {
         sp[-argc - 1] = field->second;
-        return callValue(value, argc);
+        return callValue(field->second, argc);
     }
 
     return invokeFromClass(instance->klass, methodName, argc);
@@ -220,6 +904,7 @@ bool Interpreter::invokeFromClass(ClassValue klass, std::string methodName, u8 a
 
     if (method == klass->methods.end()) {
         runtimeError(formatStr("Undefined property %s", methodName.c_str()));
+        return false;
     }
 
     return callClosure(AS_CLOSURE(method->second), argc);
@@ -233,7 +918,7 @@ bool Interpreter::bindMethod(ClassValue klass, std::string name) {
         return false;
     }
 
-    BoundMethodValue bound = std::make_shared<BoundMethod>(AS_CLOSURE(value->second), peek(0));
+    BoundMethodValue bound = allocate<BoundMethod>(AS_CLOSURE(value->second), peek(0));
 
     pop();
     push(bound);
@@ -241,11 +926,217 @@ bool Interpreter::bindMethod(ClassValue klass, std::string name) {
     return true;
 }
 
+// Modules
+
+std::map<std::string, Value> &Interpreter::globalsOf(CallFrame* frame) {
+    return frame->closure->module != nullptr ? frame->closure->module->globals : globals;
+}
+
+// Runs name.jake the first time it's imported, later imports get the same module. It's cached
+// before it runs, so modules importing each other get the partly run module instead of
+// recursing forever.
+InterpreterResult Interpreter::importModule(const std::string &name, ModuleValue &module) {
+    auto cached = modules.find(name);
+
+    if (cached != modules.end()) {
+        module = cached->second;
+        return InterpreterResult::Success;
+    }
+
+    std::vector<std::string> directories = moduleDirectories;
+    for (std::string &directory : environmentModulePaths())
+        directories.push_back(std::move(directory));
+
+    std::string path = findModule(directories, name);
+
+    if (path.empty()) {
+        runtimeError(formatStr("Module %s not found", name.c_str()));
+        return InterpreterResult::Error;
+    }
+
+    // Constants of loaded modules are kept like compiled ones, uncharged, see Parser::compile
+    HeapScope uncharged(nullptr);
+    FunctionValue function = moduleCache ? loadCompiledModule(path) : nullptr;
+
+    if (function == nullptr) {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream stream;
+        stream << file.rdbuf();
+
+        // Cached modules are compiled whole, lazy stubs can't be saved
+        function = Parser(stream.str().c_str(), lazyCompile && !moduleCache).compile();
+
+        if (function == nullptr) {
+            runtimeError(formatStr("Could not compile module %s", name.c_str()));
+            return InterpreterResult::Error;
+        }
+
+        if (moduleCache)
+            saveCompiledModule(path, function);
+    }
+
+    module = allocate<ModuleObj>(name, path);
+
+    // Natives are globals too, every module gets the interpreter's
+    for (auto &[globalName, global] : globals) {
+        if (IS_NATIVE_FUNCTION(global) || IS_NATIVE(global))
+            module->globals[globalName] = global;
+    }
+
+    modules[name] = module;
+
+    ClosureValue closure = allocate<ClosureObj>(function);
+    closure->module = module;
+
+    Value result;
+    InterpreterResult status = call(closure, nullptr, 0, result);
+
+    if (status != InterpreterResult::Success)
+        modules.erase(name);
+
+    return status;
+}
+
+// A module's globals usually hold closures that point back at the module, clearing them breaks
+// the cycle so modules that are dropped get freed
+void Interpreter::releaseModules(const std::map<std::string, ModuleValue> &keep) {
+    for (auto &[name, module] : modules) {
+        auto kept = keep.find(name);
+
+        if (kept == keep.end() || kept->second != module)
+            module->globals.clear();
+    }
+}
+
 bool Interpreter::isFalsey(Value value) {
     return IS_NONE(value) || (IS_BOOLEAN(value) && !AS_BOOLEAN(value));
 }
 
+// Negative indices count back from the end, kind names the container in error messages
+static bool indexSlot(const char* kind, size_t size, Value &index, size_t &slot, std::string &error) {
+    if (!IS_NUMBER(index)) {
+        error = formatStr("%s index must be a number", kind);
+        return false;
+    }
+
+    double position = AS_NUMBER(index);
+
+    if (position != std::floor(position)) {
+        error = formatStr("%s index must be a whole number", kind);
+        return false;
+    }
+
+    if (position < 0)
+        position += (double) size;
+
+    if (position < 0 || position >= (double) size) {
+        error = formatStr("%s index out of range", kind);
+        return false;
+    }
+
+    slot = (size_t) position;
+    return true;
+}
+
+bool Interpreter::indexGet(Value &container, Value &index) {
+    if (IS_MAP(container)) {
+        Value* value = isHashable(index) ? AS_MAP(container)->find(index) : nullptr;
+
+        if (value == nullptr) {
+            runtimeError("Key not found in map");
+            return false;
+        }
+
+        push(*value);
+        return true;
+    }
+
+    std::string error;
+    size_t slot;
+
+    if (IS_TYPED_ARRAY(container)) {
+        TypedArrayObj* array = AS_TYPED_ARRAY(container).get();
+
+        if (!indexSlot("Array", array->length(), index, slot, error)) {
+            runtimeError(error);
+            return false;
+        }
+
+        push(NUMBER_VAL(array->get(slot)));
+        return true;
+    }
+
+    if (!IS_LIST(container)) {
+        runtimeError("Only lists, maps and arrays can be indexed");
+        return false;
+    }
+
+    ListObj* list = AS_LIST(container).get();
+
+    if (!indexSlot("List", list->items.size(), index, slot, error)) {
+        runtimeError(error);
+        return false;
+    }
+
+    push(list->items[slot]);
+    return true;
+}
+
+bool Interpreter::indexSet(Value &container, Value &index, Value &value) {
+    if (IS_MAP(container)) {
+        if (!isHashable(index)) {
+            runtimeError("NaN can't be used as a map key");
+            return false;
+        }
+
+        AS_MAP(container)->set(index, value);
+        push(std::move(value));
+        return true;
+    }
+
+    std::string error;
+    size_t slot;
+
+    if (IS_TYPED_ARRAY(container)) {
+        TypedArrayObj* array = AS_TYPED_ARRAY(container).get();
+
+        if (!IS_NUMBER(value)) {
+            runtimeError(formatStr("%s elements must be numbers", array->typeName()));
+            return false;
+        }
+
+        if (!indexSlot("Array", array->length(), index, slot, error)) {
+            runtimeError(error);
+            return false;
+        }
+
+        array->set(slot, AS_NUMBER(value));
+        push(std::move(value));
+        return true;
+    }
+
+    if (!IS_LIST(container)) {
+        runtimeError("Only lists, maps and arrays can be indexed");
+        return false;
+    }
+
+    ListObj* list = AS_LIST(container).get();
+
+    if (!indexSlot("List", list->items.size(), index, slot, error)) {
+        runtimeError(error);
+        return false;
+    }
+
+    list->items[slot] = value;
+    push(std::move(value));
+    return true;
+}
+
 bool Interpreter::valuesEqual(Value valueA, Value valueB) {
+    // A slice equals any string with the same text
+    if (IS_TEXT(valueA) && IS_TEXT(valueB))
+        return textOf(valueA) == textOf(valueB);
+
     if (valueA.type() != valueB.type())
         return false;
 
@@ -256,6 +1147,44 @@ bool Interpreter::valuesEqual(Value valueA, Value valueB) {
             return AS_BOOLEAN(valueA) == AS_BOOLEAN(valueB);
         case ValueType::None:
             return true;
+        case ValueType::String:
+            return AS_STRING(valueA) == AS_STRING(valueB);
+        case ValueType::NativeFunc:
+            return AS_NATIVE_FUNCTION(valueA) == AS_NATIVE_FUNCTION(valueB);
+
+        // Objects compare by identity
+        case ValueType::Function:
+            return AS_FUNCTION(valueA) == AS_FUNCTION(valueB);
+        case ValueType::Closure:
+            return AS_CLOSURE(valueA) == AS_CLOSURE(valueB);
+        case ValueType::Class:
+            return AS_CLASS(valueA) == AS_CLASS(valueB);
+        case ValueType::Instance:
+            return AS_INSTANCE(valueA) == AS_INSTANCE(valueB);
+        case ValueType::BoundMethod:
+            return AS_BOUND_METHOD(valueA) == AS_BOUND_METHOD(valueB);
+        case ValueType::Native:
+            return AS_NATIVE(valueA) == AS_NATIVE(valueB);
+        case ValueType::Thread:
+            return AS_THREAD(valueA) == AS_THREAD(valueB);
+        case ValueType::Channel:
+            return AS_CHANNEL(valueA) == AS_CHANNEL(valueB);
+        case ValueType::Coroutine:
+            return AS_COROUTINE(valueA) == AS_COROUTINE(valueB);
+        case ValueType::File:
+            return AS_FILE(valueA) == AS_FILE(valueB);
+        case ValueType::MappedFile:
+            return AS_MAPPED_FILE(valueA) == AS_MAPPED_FILE(valueB);
+        case ValueType::List:
+            return AS_LIST(valueA) == AS_LIST(valueB);
+        case ValueType::Map:
+            return AS_MAP(valueA) == AS_MAP(valueB);
+        case ValueType::TypedArray:
+            return AS_TYPED_ARRAY(valueA) == AS_TYPED_ARRAY(valueB);
+        case ValueType::StringBuilder:
+            return AS_STRING_BUILDER(valueA) == AS_STRING_BUILDER(valueB);
+        case ValueType::Module:
+            return AS_MODULE(valueA) == AS_MODULE(valueB);
 
         default:
             return false;
@@ -267,20 +1196,22 @@ bool Interpreter::valuesEqual(Value valueA, Value valueB) {
 #define READ_CONSTANT() frame->closure->function->chunk.constants[READ_BYTE()]
 #define READ_STRING() AS_STRING(READ_CONSTANT())
 #define READ_SHORT() (frame->ip += 2, (u16) ((frame->ip[-1] << 8) | frame->ip[-2]))
+#define CHECK_LIMITS() if (fuel < 0 && !checkLimits()) return limitResult
+#define THROW_ERROR() goto error
 
-InterpreterResult Interpreter::run() {
+InterpreterResult Interpreter::run(int baseFrame, Fiber* baseFiber) {
     CallFrame* frame = &frames[frameCount - 1];
 
-    int pc = 0;
-
     for (;;) {
-        u8 instruction = READ_BYTE();
+        #ifdef OPCODESTATS
+            opcodeStats.record(frame->closure->function, (int) (frame->ip - frame->closure->function->chunk.bytecode.data()), *frame->ip);
+        #endif
 
-        pc++;
+        #ifdef OPCODECYCLES
+            opcodeStats.tick(*frame->ip);
+        #endif
 
-        if (pc == 51) {
-            print("made it to 51");
-        }
+        u8 instruction = READ_BYTE();
 
         switch (instruction) {
             case OpPop: {
@@ -292,14 +1223,20 @@ InterpreterResult Interpreter::run() {
                 Value result = pop();
                 closeUpValues(frame->slots);
                 frameCount--;
-                
-                if (frameCount == 0) {                    
-                    pop();
-                    return InterpreterResult::Success;
-                }
 
+                stackHighWater = std::max(stackHighWater, sp);
                 sp = frame->slots;
-                push(result);
+
+                if (frameCount == 0 && fiber->coroutine != nullptr) {
+                    fiber->coroutine->state = CoroutineState::Done;
+                    leaveCoroutine(std::move(result));
+                } else {
+                    push(result);
+                }
+
+                if (frameCount == baseFrame && fiber == baseFiber)
+                    return InterpreterResult::Success;
+
                 frame = &frames[frameCount - 1];
                 break;
             }
@@ -331,11 +1268,28 @@ InterpreterResult Interpreter::run() {
                 if (IS_NUMBER(a) && IS_NUMBER(b)) {
                     push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
 
-                } else if (IS_STRING(a) && IS_STRING(b)) {
-                    push(AS_STRING(a) + AS_STRING(b));
+                } else if (IS_TEXT(a) && IS_TEXT(b)) {
+                    std::string_view right = textOf(b);
+
+                    if (!heap->canAllocate(textOf(a).size() + right.size())) {
+                        stopForLimit(InterpreterResult::MemoryLimit, "Heap quota exceeded");
+                        return limitResult;
+                    }
+
+                    // a was moved off the stack, so it can be appended to in place
+                    if (IS_STRING(a)) {
+                        AS_STRING(a) += right;
+                        push(std::move(a));
+                    } else {
+                        std::string result;
+                        result.reserve(textOf(a).size() + right.size());
+                        result += textOf(a);
+                        result += right;
+                        push(std::move(result));
+                    }
                 } else {
                     runtimeError("Can only add numbers or strings");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 break;
@@ -347,7 +1301,7 @@ InterpreterResult Interpreter::run() {
 
                 if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
                     runtimeError("Can only subtract numbers");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b)));
@@ -360,7 +1314,7 @@ InterpreterResult Interpreter::run() {
 
                 if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
                     runtimeError("Can only multiply numbers");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
                 push(NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b)));
                 break;
@@ -372,7 +1326,7 @@ InterpreterResult Interpreter::run() {
 
                 if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
                     runtimeError("Can only divide numbers");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b)));
@@ -383,11 +1337,6 @@ InterpreterResult Interpreter::run() {
                 Value b = pop();
                 Value a = pop();
 
-                if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
-                    runtimeError("Can only compair numbers");
-                    return InterpreterResult::Error;
-                }
-
                 push(BOOLEAN_VAL(valuesEqual(a, b)));
 
                 break;
@@ -397,11 +1346,6 @@ InterpreterResult Interpreter::run() {
                 Value b = pop();
                 Value a = pop();
 
-                if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
-                    runtimeError("Can only compair numbers");
-                    return InterpreterResult::Error;
-                }
-
                 push(BOOLEAN_VAL(!valuesEqual(a, b)));
 
                 break;
@@ -413,7 +1357,7 @@ InterpreterResult Interpreter::run() {
 
                 if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
                     runtimeError("Can only compair numbers");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(BOOLEAN_VAL(AS_NUMBER(a) > AS_NUMBER(b)));
@@ -427,7 +1371,7 @@ InterpreterResult Interpreter::run() {
                 
                 if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
                     runtimeError("Can only compair numbers");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(BOOLEAN_VAL(AS_NUMBER(a) < AS_NUMBER(b)));
@@ -441,7 +1385,7 @@ InterpreterResult Interpreter::run() {
 
                 if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
                     runtimeError("Can only compair numbers");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(BOOLEAN_VAL(AS_NUMBER(a) >= AS_NUMBER(b)));
@@ -455,7 +1399,7 @@ InterpreterResult Interpreter::run() {
 
                 if (a.type() != ValueType::Number || b.type() != ValueType::Number) {
                     runtimeError("Can only compair numbers");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(BOOLEAN_VAL(AS_NUMBER(a) <= AS_NUMBER(b)));
@@ -468,7 +1412,7 @@ InterpreterResult Interpreter::run() {
 
                 if (a.type() != ValueType::Number) {
                     runtimeError("Can only negate a number");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(NUMBER_VAL(-AS_NUMBER(a)));
@@ -481,26 +1425,26 @@ InterpreterResult Interpreter::run() {
             }
 
             case OpPrint: {
-                printValue(pop());
-                printf("\n");
+                output.writeLine(pop());
                 break;
             }
 
             case OpDefineGlobal: {
                 StringValue str = READ_STRING();
-                globals[str] = peek(0);
+                globalsOf(frame)[str] = peek(0);
                 pop();
                 break;
             }
 
             case OpGetGlobal: {
                 std::string name = READ_STRING();
+                std::map<std::string, Value> &table = globalsOf(frame);
 
-                auto value = globals.find(name);
+                auto value = table.find(name);
 
-                if (value == globals.end()) {
+                if (value == table.end()) {
                     runtimeError(formatStr("Undefined variable %s", name.c_str()));
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 push(value->second);
@@ -509,12 +1453,13 @@ InterpreterResult Interpreter::run() {
 
             case OpSetGlobal: {
                 std::string name = READ_STRING();
+                std::map<std::string, Value> &table = globalsOf(frame);
 
-                auto value = globals.find(name);
+                auto value = table.find(name);
 
-                if (value == globals.end()) {
+                if (value == table.end()) {
                     runtimeError(formatStr("Undefined variable %s", name.c_str()));
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 value->second = peek(0);
@@ -537,7 +1482,10 @@ InterpreterResult Interpreter::run() {
             }
 
             case OpJumpBack: {
-                frame->ip -= READ_SHORT();
+                u16 distance = READ_SHORT();
+                frame->ip -= distance;
+                fuel -= distance;
+                CHECK_LIMITS();
                 break;
             }
 
@@ -557,18 +1505,22 @@ InterpreterResult Interpreter::run() {
                 u8 argc = READ_BYTE();
                 Value value = peek(argc);
 
-                if (!callValue(value, argc)) {
-                    runtimeError("Invalid call target");
-                    return InterpreterResult::Error;
-                }
-                
+                if (!callValue(value, argc))
+                    THROW_ERROR();
+
+                // A native can suspend the coroutine, handing control back to call()
+                if (frameCount == baseFrame && fiber == baseFiber)
+                    return InterpreterResult::Success;
+
                 frame = &frames[frameCount - 1];
+                CHECK_LIMITS();
                 break;
             }
             
             case OpClosure: {
                 FunctionValue function = AS_FUNCTION(READ_CONSTANT());
-                ClosureValue closure = std::make_shared<ClosureObj>(function);
+                ClosureValue closure = allocate<ClosureObj>(function);
+                closure->module = frame->closure->module;
                 push(closure);
 
                 for (int i = 0; i < (signed) closure->function->upValueCount; i++) {
@@ -603,14 +1555,42 @@ InterpreterResult Interpreter::run() {
             }
 
             case OpClass: {
-                push(std::make_shared<ClassObj>(READ_STRING()));
+                push(allocate<ClassObj>(READ_STRING()));
                 break;
             }
 
             case OpGetProperty: {
+                if (IS_MODULE(peek(0))) {
+                    ModuleValue module = AS_MODULE(pop());
+                    const std::string &name = READ_STRING();
+                    auto member = module->globals.find(name);
+
+                    if (member == module->globals.end()) {
+                        runtimeError(formatStr("Module %s has no member %s", module->name.c_str(), name.c_str()));
+                        THROW_ERROR();
+                    }
+
+                    push(member->second);
+                    break;
+                }
+
+                // A caught runtime error is an exception, its message is the only thing to read
+                if (IS_EXCEPTION(peek(0))) {
+                    ExceptionValue exception = AS_EXCEPTION(pop());
+                    const std::string &name = READ_STRING();
+
+                    if (name != "message") {
+                        runtimeError(formatStr("Exception has no property %s", name.c_str()));
+                        THROW_ERROR();
+                    }
+
+                    push(exception->msg);
+                    break;
+                }
+
                 if (!IS_INSTANCE(peek(0))) {
                     runtimeError("Only instances have properties");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
                 
                 InstanceValue instance = AS_INSTANCE(peek(0));
@@ -623,7 +1603,7 @@ InterpreterResult Interpreter::run() {
                     push(field->second);
                 } else {
                     if (!bindMethod(instance->klass, name)) {
-                        return InterpreterResult::Error;
+                        THROW_ERROR();
                     }
                 }
 
@@ -634,7 +1614,7 @@ InterpreterResult Interpreter::run() {
             case OpSetProperty: {
                 if (!IS_INSTANCE(peek(1))) {
                     runtimeError("Only instances have properties");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 InstanceValue instance = AS_INSTANCE(peek(1));
@@ -656,10 +1636,14 @@ InterpreterResult Interpreter::run() {
                 int argc = READ_BYTE();
 
                 if (!invoke(method, argc)) {
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
+                if (frameCount == baseFrame && fiber == baseFiber)
+                    return InterpreterResult::Success;
+
                 frame = &frames[frameCount - 1];
+                CHECK_LIMITS();
                 break;
             }
 
@@ -668,7 +1652,7 @@ InterpreterResult Interpreter::run() {
 
                 if (!IS_CLASS(baseClass)) {
                     runtimeError("Can only inherit from a class");
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 ClassValue subClass = AS_CLASS(peek(0));
@@ -683,22 +1667,178 @@ InterpreterResult Interpreter::run() {
                 ClassValue superSlass = AS_CLASS(pop());
 
                 if (!bindMethod(superSlass, name)) {
-                    return InterpreterResult::Error;
+                    THROW_ERROR();
                 }
 
                 break;
 
             }
 
+            case OpYield: {
+                if (!yieldCoroutine(pop()))
+                    THROW_ERROR();
+
+                if (frameCount == baseFrame && fiber == baseFiber)
+                    return InterpreterResult::Success;
+
+                frame = &frames[frameCount - 1];
+                break;
+            }
+
+            case OpBuildList: {
+                int count = READ_BYTE();
+                ListValue list = allocate<ListObj>(heap.get());
+
+                list->items.reserve(count);
+                for (Value* element = sp - count; element < sp; element++)
+                    list->items.push_back(std::move(*element));
+
+                sp -= count;
+                push(list);
+                break;
+            }
+
+            case OpBuildMap: {
+                int count = READ_BYTE();
+                MapValue map = allocate<MapObj>(heap.get());
+
+                for (Value* pair = sp - count * 2; pair < sp; pair += 2) {
+                    if (!isHashable(pair[0])) {
+                        runtimeError("NaN can't be used as a map key");
+                        THROW_ERROR();
+                    }
+
+                    map->set(pair[0], std::move(pair[1]));
+                    pair[0] = NONE_VAL();
+                }
+
+                sp -= count * 2;
+                push(map);
+                break;
+            }
+
+            case OpIndexGet: {
+                Value index = pop();
+                Value container = pop();
+
+                if (!indexGet(container, index))
+                    THROW_ERROR();
+
+                break;
+            }
+
+            case OpIndexSet: {
+                Value value = pop();
+                Value index = pop();
+                Value container = pop();
+
+                if (!indexSet(container, index, value))
+                    THROW_ERROR();
+
+                break;
+            }
+
+            case OpAddAssign: {
+                u8 setOp = READ_BYTE();
+                Value* target;
+
+                if (setOp == OpSetLocal) {
+                    target = &frame->slots[READ_BYTE()];
+                } else if (setOp == OpSetUpValue) {
+                    target = frame->closure->upValues[READ_BYTE()]->location;
+                } else {
+                    const std::string &name = READ_STRING();
+                    std::map<std::string, Value> &table = globalsOf(frame);
+                    auto global = table.find(name);
+
+                    if (global == table.end()) {
+                        runtimeError(formatStr("Undefined variable %s", name.c_str()));
+                        THROW_ERROR();
+                    }
+
+                    target = &global->second;
+                }
+
+                Value operand = pop();
+
+                if (IS_NUMBER(*target) && IS_NUMBER(operand)) {
+                    *target = NUMBER_VAL(AS_NUMBER(*target) + AS_NUMBER(operand));
+
+                } else if (IS_TEXT(*target) && IS_TEXT(operand)) {
+                    if (!heap->canAllocate(textOf(*target).size() + textOf(operand).size())) {
+                        stopForLimit(InterpreterResult::MemoryLimit, "Heap quota exceeded");
+                        return limitResult;
+                    }
+
+                    if (IS_STRING_SLICE(*target))
+                        *target = std::string(textOf(*target));
+
+                    AS_STRING(*target) += textOf(operand);
+                } else {
+                    runtimeError("Can only add numbers or strings");
+                    THROW_ERROR();
+                }
+
+                // As a statement the result is thrown away straight after, skip copying it
+                if (*frame->ip == OpPop)
+                    frame->ip++;
+                else
+                    push(*target);
+
+                break;
+            }
+
+            case OpImport: {
+                ModuleValue module;
+                InterpreterResult status = importModule(READ_STRING(), module);
+
+                if (status == InterpreterResult::Error)
+                    THROW_ERROR();
+
+                if (status != InterpreterResult::Success)
+                    return status;
+
+                push(module);
+                break;
+            }
+
+            case OpThrow: {
+                thrown = pop();
+
+                std::string message;
+                if (IS_EXCEPTION(thrown))
+                    message = AS_EXCEPTION(thrown)->msg;
+                else
+                    formatValue(message, thrown);
+
+                errorMessage = message;
+                errorTrace.clear();
+                THROW_ERROR();
+            }
+
             default: {
-                runtimeError(formatStr("Unknown Instruction (%d)", (int) instruction));
+                fatalError(formatStr("Unknown Instruction (%d)", (int) instruction));
                 return InterpreterResult::Error;
             }
         }
+
+        continue;
+
+    error:
+        if (limitReached) {
+            thrown = NONE_VAL();
+            return limitResult;
+        }
+
+        if (!catchError(baseFrame, baseFiber))
+            return InterpreterResult::Error;
+
+        frame = &frames[frameCount - 1];
     }
 }
 
 #undef READ_BYTE
 #undef READ_CONSTANT
 #undef READ_STRING
-#undef READ_SHORT
\ No newline at end of file
+#undef READ_SHORT
+#undef CHECK_LIMITS
\ No newline at end of file
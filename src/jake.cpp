@@ -0,0 +1,80 @@
+#include "jake.h"
+
+namespace jake {
+
+    // The interpreter is ~600KB of stack and frames, too big for a host's own stack
+    VM::VM() : interpreter(std::make_unique<Interpreter>()) {}
+
+    VM::~VM() = default;
+
+    Script VM::compile(const std::string &source) {
+        return Script(interpreter->compile(source.c_str()));
+    }
+
+    Result VM::run(const Script &script) {
+        if (!script.valid())
+            return Result::Error;
+
+        return interpreter->execute(script.function);
+    }
+
+    Result VM::run(const std::string &source) {
+        return run(compile(source));
+    }
+
+    Value VM::get(const std::string &name) {
+        Value value;
+        interpreter->getGlobal(name, value);
+        return value;
+    }
+
+    bool VM::has(const std::string &name) {
+        Value value;
+        return interpreter->getGlobal(name, value);
+    }
+
+    void VM::set(const std::string &name, const Value &value) {
+        interpreter->setGlobal(name, value);
+    }
+
+    void VM::define(const std::string &name, Native function, void* userData) {
+        interpreter->defineNative(name, function, userData);
+    }
+
+    void VM::reset() {
+        interpreter->reset();
+    }
+
+    void VM::setLimits(const Limits &limits) {
+        interpreter->setLimits(limits);
+    }
+
+    void VM::addModulePath(const std::string &directory) {
+        interpreter->addModulePath(directory);
+    }
+
+    void VM::setModuleCache(bool enabled) {
+        interpreter->setModuleCache(enabled);
+    }
+
+    void VM::setLazyCompile(bool enabled) {
+        interpreter->setLazyCompile(enabled);
+    }
+
+    void VM::setOutput(OutputSink sink, void* userData) {
+        interpreter->output.setSink(sink, userData);
+    }
+
+    void VM::flush() {
+        interpreter->output.flush();
+    }
+
+    const std::string &VM::error() {
+        return interpreter->lastError();
+    }
+
+    Interpreter &VM::raw() {
+        return *interpreter;
+    }
+
+}
@@ -4,13 +4,13 @@
 // TODO: Add Stuff
 
 void printError(ExceptionType type, std::string msg, int line, std::string value) {
-    std::cout << color::red << color::bold;
-    printf("Jake++ error on line %d:\n", line);
-
-    printf("    %s: %s", exceptionNames[(int) type], msg.c_str());
+    std::string text = color::red + color::bold + formatStr("Jake++ error on line %d:\n    %s: %s", line, exceptionNames[(int) type], msg.c_str());
 
     if (value.size())
-        printf(" \'%s\'", value.c_str());
-    
-    std::cout << color::reset << std::endl;
+        text += formatStr(" \'%s\'", value.c_str());
+
+    text += color::reset + "\n";
+
+    fputs(text.c_str(), stdout);
+    fflush(stdout);
 }
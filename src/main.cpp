@@ -2,9 +2,11 @@
 #include <string>
 #include <sstream>
 #include <chrono>
+#include <filesystem>
 #include "benchmark.h"
 #include "common.h"
 #include "interpreter.h"
+#include "profiler.h"
 #include "color.h"
 
 Interpreter interpreter;
@@ -31,19 +33,270 @@ int main() {
 
 #else
 
-void repl() {
-    print("Repl not defined yet");
-    exit(1);
+enum class RunMode {
+    Run,
+    CompileOnly,
+    ScanOnly
+};
+
+struct RunOptions {
+    RunMode mode = RunMode::Run;
+    bool phaseTimes = false;
+    bool json = false;
+    bool cacheModules = false;
+    bool lazyCompile = false;
+    bool repl = false;
+    const char* profilePath = nullptr;
+    int profileInterval = 1000;
+    InterpreterLimits limits;
+};
+
+struct PhaseTimes {
+    double read = 0;
+    double scan = 0;
+    double compile = 0;
+    double execute = 0;
+    size_t bytes = 0;
+    size_t tokens = 0;
+    bool scanned = false;
+    bool compiled = false;
+    bool executed = false;
+};
+
+template <class Timer>
+double elapsedMilliseconds(const Timer &clock) {
+    return clock.duration().count() / 1000.0;
+}
+
+// Standalone pass over the source, the parser scans again while compiling
+size_t scanSource(const char* source, bool &hadError) {
+    Scanner scanner = Scanner(source);
+    size_t tokenCount = 0;
+
+    for (;;) {
+        Token token = scanner.scanToken();
+        tokenCount++;
+
+        if (token.type == TokenType::EndOfFile)
+            break;
+
+        if (token.type == TokenType::Error) {
+            if (!scanner.handledError)
+                printError(ExceptionType::SyntaxError, "Unexpected character", token.line, std::string(token.source));
+            hadError = true;
+            break;
+        }
+    }
+
+    return tokenCount;
+}
+
+void printPhaseTimes(const PhaseTimes &times) {
+    std::cout << color::brightBlack;
+
+    printf(">> read     %10.3f ms (%zu bytes)\n", times.read, times.bytes);
+
+    if (times.scanned)
+        printf(">> scan     %10.3f ms (%zu tokens)\n", times.scan, times.tokens);
+
+    if (times.compiled)
+        printf(">> compile  %10.3f ms\n", times.compile);
+
+    if (times.executed)
+        printf(">> execute  %10.3f ms\n", times.execute);
+
+    std::cout << color::reset;
+}
+
+void printJsonTimes(const char* path, const char* status, const PhaseTimes &times) {
+    std::string escapedPath;
+    for (const char* c = path; *c; c++) {
+        if (*c == '"' || *c == '\\') escapedPath += '\\';
+        escapedPath += *c;
+    }
+
+    fprintf(stderr, "{\"file\": \"%s\", \"status\": \"%s\", \"bytes\": %zu", escapedPath.c_str(), status, times.bytes);
+
+    if (times.scanned)
+        fprintf(stderr, ", \"tokens\": %zu", times.tokens);
+
+    fprintf(stderr, ", \"phases\": {\"read_ms\": %.3f", times.read);
+
+    if (times.scanned)
+        fprintf(stderr, ", \"scan_ms\": %.3f", times.scan);
+
+    if (times.compiled)
+        fprintf(stderr, ", \"compile_ms\": %.3f", times.compile);
+
+    if (times.executed)
+        fprintf(stderr, ", \"execute_ms\": %.3f", times.execute);
+
+    fprintf(stderr, ", \"total_ms\": %.3f}}\n", times.read + times.scan + times.compile + times.execute);
+}
+
+// Input continues on the next line while a bracket is still open. The input is scanned the way
+// the compiler will scan it, so brackets inside strings and comments don't count. last is set
+// to the final token, EndOfFile when there is nothing but whitespace and comments.
+bool inputComplete(const std::string &input, Token &last) {
+    Scanner scanner = Scanner(input.c_str());
+    scanner.reportErrors = false;
+
+    int depth = 0;
+    last = Token{TokenType::EndOfFile, std::string_view(), 0};
+
+    for (Token token = scanner.scanToken(); token.type != TokenType::EndOfFile; token = scanner.scanToken()) {
+        last = token;
+
+        switch (token.type) {
+            case TokenType::LeftParen:
+            case TokenType::LeftBrace:
+            case TokenType::LeftBracket:
+                depth++;
+                break;
+
+            case TokenType::RightParen:
+            case TokenType::RightBrace:
+            case TokenType::RightBracket:
+                depth--;
+                break;
+
+            // Compiling reports it
+            case TokenType::Error:
+                return true;
+
+            default:
+                break;
+        }
+    }
+
+    return depth <= 0;
+}
+
+// Runs a loop around the body n times and returns the seconds it took
+double timeLoop(const std::string &body, long long count, bool &failed) {
+    std::string source = "for (var __time = 0; __time < " + std::to_string(count) + "; __time = __time + 1) { " + body + " }";
+    FunctionValue function = interpreter.compile(source.c_str());
+
+    if (function == nullptr) {
+        failed = true;
+        return 0;
+    }
+
+    Timer<std::chrono::nanoseconds> clock;
+    clock.tick();
+    InterpreterResult result = interpreter.execute(function);
+    clock.tock();
+
+    failed = result != InterpreterResult::Success;
+    return clock.duration().count() / 1e9;
+}
+
+// :time N expr, the cost of an empty loop of the same length is taken off
+void timeExpression(const std::string &arguments) {
+    std::istringstream stream(arguments);
+    long long count = 0;
+    std::string expression;
+
+    // Signed, an unsigned read would turn -1 into a count that never finishes
+    if (!(stream >> count))
+        count = 0;
+
+    std::getline(stream >> std::ws, expression);
+
+    while (!expression.empty() && (isspace(expression.back()) || expression.back() == ';'))
+        expression.pop_back();
+
+    if (count <= 0 || expression.empty()) {
+        print("Usage: :time N expression");
+        return;
+    }
+
+    bool failed = false;
+    double total = timeLoop(expression + ";", count, failed);
+    if (failed)
+        return;
+
+    double overhead = timeLoop("", count, failed);
+    double perIteration = std::max(0.0, total - overhead) / count;
+
+    std::cout << color::brightBlack;
+    printf(">> %lld iterations in %.3f ms, %.1f ns per iteration\n", count, total * 1e3, perIteration * 1e9);
+    std::cout << color::reset;
 }
 
-void runFile(const char* path) {
+// Every entry is compiled on its own and run in the same interpreter, so globals, functions
+// and classes defined earlier stay available. An expression on its own prints its value.
+void repl(const RunOptions &options) {
+    interpreter.setLimits(options.limits);
+    interpreter.addModulePath(std::filesystem::current_path().string());
+    interpreter.setModuleCache(options.cacheModules);
+    interpreter.setLazyCompile(options.lazyCompile);
+
+    std::string input;
+    std::string line;
+
+    for (;;) {
+        std::cout << (input.empty() ? "> " : "... ") << std::flush;
+
+        if (!std::getline(std::cin, line)) {
+            std::cout << std::endl;
+            break;
+        }
+
+        if (input.empty()) {
+            std::string_view command = line;
+
+            if (command == ":quit")
+                break;
+
+            if (command.rfind(":time", 0) == 0) {
+                timeExpression(line.substr(5));
+                continue;
+            }
+
+            if (command.empty())
+                continue;
+        }
+
+        input += line;
+        input += '\n';
+
+        Token last;
+        if (!inputComplete(input, last))
+            continue;
+
+        if (last.type == TokenType::EndOfFile) {
+            input.clear();
+            continue;
+        }
+
+        // A missing semicolon after the last statement is forgiven, it goes right after the
+        // last token so a trailing comment doesn't swallow it
+        if (last.type != TokenType::Semicolon && last.type != TokenType::RightBrace) {
+            size_t end = last.source.data() + last.source.size() - input.data();
+            input.insert(input.begin() + end, ';');
+        }
+
+        FunctionValue function = interpreter.compile(input.c_str(), true);
+        input.clear();
+
+        if (function != nullptr)
+            interpreter.execute(function);
+    }
+}
+
+int runFile(const char* path, const RunOptions &options) {
+    PhaseTimes times;
+    Timer<std::chrono::microseconds> clock;
+
+    clock.tick();
     std::fstream file;
 
     file.open(path);
 
     if (!file.is_open()) {
         print("[Error] Failed to open source file");
-        return;
+        return 74;
     }
 
     std::stringstream stream;
@@ -51,30 +304,182 @@ void runFile(const char* path) {
     std::string source = stream.str();
 
     file.close();
+    clock.tock();
 
-    Timer<std::chrono::microseconds> clock;
+    times.read = elapsedMilliseconds(clock);
+    times.bytes = source.size();
 
-    clock.tick();
-    InterpreterResult status = interpreter.interpret(source.c_str());
-    clock.tock();
+    const char* status = "success";
+    int exitCode = 0;
+
+    if (options.phaseTimes || options.mode == RunMode::ScanOnly) {
+        bool hadError = false;
+
+        clock.tick();
+        times.tokens = scanSource(source.c_str(), hadError);
+        clock.tock();
+
+        times.scan = elapsedMilliseconds(clock);
+        times.scanned = true;
+
+        if (hadError) {
+            status = "scan_error";
+            exitCode = 65;
+        }
+    }
+
+    if (!exitCode && options.mode != RunMode::ScanOnly) {
+        interpreter.setLimits(options.limits);
+
+        // Modules next to the script come first
+        interpreter.addModulePath(std::filesystem::path(path).parent_path().string());
+        interpreter.setModuleCache(options.cacheModules);
+        interpreter.setLazyCompile(options.lazyCompile);
+
+        clock.tick();
+        FunctionValue function = interpreter.compile(source.c_str());
+        clock.tock();
+
+        times.compile = elapsedMilliseconds(clock);
+        times.compiled = true;
+
+        if (function == nullptr) {
+            status = "compile_error";
+            exitCode = 65;
+        } else if (options.mode == RunMode::Run) {
+            Profiler profiler = Profiler(&interpreter, options.profileInterval);
+
+            if (options.profilePath && !profiler.start())
+                print("[Error] Sampling profiler is not supported on this platform");
+
+            clock.tick();
+            InterpreterResult result = interpreter.execute(function);
+            clock.tock();
+
+            if (options.profilePath) {
+                profiler.stop();
+
+                if (profiler.writeCollapsed(options.profilePath)) {
+                    std::cout << color::brightBlack;
+                    printf(">> profile: %d samples (%d dropped) written to %s\n", profiler.sampleCount(), profiler.droppedCount(), options.profilePath);
+                    std::cout << color::reset;
+                } else {
+                    printf("[Error] Failed to write profile to %s\n", options.profilePath);
+                }
+            }
+
+            times.execute = elapsedMilliseconds(clock);
+            times.executed = true;
+
+            #ifdef OPCODESTATS
+                interpreter.opcodeStats.report(stderr);
+            #endif
+
+            switch (result) {
+                case InterpreterResult::Success:
+                    break;
+                case InterpreterResult::Error:
+                    status = "runtime_error";
+                    exitCode = 70;
+                    break;
+                case InterpreterResult::InstructionLimit:
+                    status = "instruction_limit";
+                    exitCode = 75;
+                    break;
+                case InterpreterResult::MemoryLimit:
+                    status = "memory_limit";
+                    exitCode = 75;
+                    break;
+                case InterpreterResult::Timeout:
+                    status = "timeout";
+                    exitCode = 75;
+                    break;
+            }
+        }
+    }
 
-    if (status == InterpreterResult::Error)
-        std::cout << color::brightBlack << ">> Interpreter finished with error in " << clock.duration().count() / 100 << " milliseconds <<\n" << color::reset;
-    else
-        std::cout << color::brightBlack << ">> Interpreter finished in " << clock.duration().count() / 100 << " milliseconds <<\n" << color::reset;
+    if (options.json) {
+        printJsonTimes(path, status, times);
+    } else if (options.phaseTimes) {
+        printPhaseTimes(times);
+    } else {
+        double total = times.compile + times.execute;
+
+        if (exitCode)
+            std::cout << color::brightBlack << ">> Interpreter finished with error in " << total << " milliseconds <<\n" << color::reset;
+        else
+            std::cout << color::brightBlack << ">> Interpreter finished in " << total << " milliseconds <<\n" << color::reset;
+    }
+
+    return exitCode;
+}
+
+void printUsage() {
+    print("Usage: jake-lang [options] [path]");
+    print("    --phase-times    Report read, scan, compile and execute times separately");
+    print("    --compile-only   Stop after compiling the script");
+    print("    --scan-only      Stop after scanning the script");
+    print("    --json           Write timings as a JSON object to stderr");
+    print("    --cache-modules  Save compiled imports as .jakec files and reuse them");
+    print("    --lazy-compile   Compile each function body the first time it is called");
+    print("    --repl           Read and run statements interactively, :time N expr times an expression");
+    print("    --profile PATH   Sample the running script and write collapsed stacks for flamegraph.pl");
+    print("                     Only the main script is sampled, time spent in spawned threads shows up");
+    print("                     wherever the script is waiting for them");
+    print("    --profile-interval US   Sampling interval in microseconds (default 1000)");
+    print("    --max-instructions N    Stop the script after N bytecode units of work");
+    print("    --max-heap BYTES        Stop the script when its objects exceed BYTES");
+    print("    --timeout MS            Stop the script after MS milliseconds");
 }
 
 int main(int argc, const char* argv[]) {
-    if (argc == 1) {
-        runFile("../code.jake");
-    } else if (argc == 2) {
-        runFile(argv[1]);
-    } else {
-        print("Usage: jake-lang [path]");
-        exit(1);
+    RunOptions options;
+    const char* path = nullptr;
+
+    for (int index = 1; index < argc; index++) {
+        std::string arg = argv[index];
+
+        if (arg == "--phase-times") {
+            options.phaseTimes = true;
+        } else if (arg == "--compile-only") {
+            options.mode = RunMode::CompileOnly;
+        } else if (arg == "--scan-only") {
+            options.mode = RunMode::ScanOnly;
+        } else if (arg == "--json") {
+            options.json = true;
+        } else if (arg == "--cache-modules") {
+            options.cacheModules = true;
+        } else if (arg == "--lazy-compile") {
+            options.lazyCompile = true;
+        } else if (arg == "--repl") {
+            options.repl = true;
+        } else if (arg == "--profile" && index + 1 < argc) {
+            options.profilePath = argv[++index];
+        } else if (arg == "--profile-interval" && index + 1 < argc) {
+            options.profileInterval = std::max(1, atoi(argv[++index]));
+        } else if (arg == "--max-instructions" && index + 1 < argc) {
+            options.limits.instructionBudget = strtoull(argv[++index], nullptr, 10);
+        } else if (arg == "--max-heap" && index + 1 < argc) {
+            options.limits.heapBytes = strtoull(argv[++index], nullptr, 10);
+        } else if (arg == "--timeout" && index + 1 < argc) {
+            options.limits.timeout = std::chrono::milliseconds(strtoll(argv[++index], nullptr, 10));
+        } else if (arg == "--help") {
+            printUsage();
+            return 0;
+        } else if (arg.rfind("--", 0) == 0 || path != nullptr) {
+            printUsage();
+            exit(1);
+        } else {
+            path = argv[index];
+        }
     }
-    
-    return 0;
+
+    if (options.repl) {
+        repl(options);
+        return 0;
+    }
+
+    return runFile(path ? path : "../code.jake", options);
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,190 @@
+#include <bit>
+#include <cmath>
+#include <functional>
+#include <string_view>
+#include "map.h"
+
+#define MAP_MIN_CAPACITY 8
+
+// Hashing
+
+// Final mix of splitmix64, spreads keys that differ in few bits (small integers, pointers)
+static inline u64 mix(u64 x) {
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static const void* objectPointer(const Value &value) {
+    return std::visit([](auto &object) -> const void* {
+        using T = std::decay_t<decltype(object)>;
+
+        if constexpr (std::is_same_v<T, NativeFuncValue>)
+            return (const void*) object;
+        else if constexpr (requires { object.get(); })
+            return object.get();
+        else
+            return nullptr;
+    }, (const ValueVariant&) value);
+}
+
+bool isHashable(const Value &key) {
+    return !IS_NUMBER(key) || !std::isnan(AS_NUMBER(key));
+}
+
+u64 hashValue(const Value &key) {
+    switch (key.type()) {
+        case ValueType::None:
+            return mix(1);
+
+        case ValueType::Boolean:
+            return mix(AS_BOOLEAN(key) ? 3 : 2);
+
+        case ValueType::Number: {
+            // 0 and -0 are equal so they must hash the same
+            double number = AS_NUMBER(key) == 0 ? 0.0 : AS_NUMBER(key);
+            return mix(std::bit_cast<u64>(number));
+        }
+
+        case ValueType::String:
+        case ValueType::StringSlice:
+            return std::hash<std::string_view>()(textOf(key));
+
+        default:
+            return mix((u64) (uintptr_t) objectPointer(key));
+    }
+}
+
+bool keysEqual(const Value &a, const Value &b) {
+    if (IS_TEXT(a) && IS_TEXT(b))
+        return textOf(a) == textOf(b);
+
+    if (a.type() != b.type())
+        return false;
+
+    switch (a.type()) {
+        case ValueType::None:
+            return true;
+        case ValueType::Boolean:
+            return AS_BOOLEAN(a) == AS_BOOLEAN(b);
+        case ValueType::Number:
+            return AS_NUMBER(a) == AS_NUMBER(b);
+        case ValueType::String:
+            return AS_STRING(a) == AS_STRING(b);
+        default:
+            return objectPointer(a) == objectPointer(b);
+    }
+}
+
+// Map
+
+MapObj::MapObj(HeapAccount* account) : entries(AccountedAllocator<Entry>(account)), slots(AccountedAllocator<i32>(account)) {}
+
+// Slot holding key, or the empty slot where it would go
+size_t MapObj::slotFor(const Value &key, u64 hash) {
+    size_t mask = slots.size() - 1;
+    size_t slot = hash & mask;
+    size_t reusable = SIZE_MAX;
+
+    for (;;) {
+        i32 position = slots[slot];
+
+        if (position == EMPTY)
+            return reusable != SIZE_MAX ? reusable : slot;
+
+        if (position == DELETED) {
+            if (reusable == SIZE_MAX)
+                reusable = slot;
+        } else {
+            Entry &entry = entries[position];
+            if (entry.hash == hash && keysEqual(entry.key, key))
+                return slot;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+}
+
+Value* MapObj::find(const Value &key) {
+    if (count == 0)
+        return nullptr;
+
+    i32 position = slots[slotFor(key, hashValue(key))];
+
+    if (position < 0)
+        return nullptr;
+
+    return &entries[position].value;
+}
+
+void MapObj::set(const Value &key, Value value) {
+    // Entries (live or removed) fill at most 2/3 of the table, removed ones are dropped on rebuild
+    if ((entries.size() + 1) * 3 > slots.size() * 2)
+        rebuild(std::max<size_t>(MAP_MIN_CAPACITY, std::bit_ceil((count + 1) * 3)));
+
+    u64 hash = hashValue(key);
+    size_t slot = slotFor(key, hash);
+
+    if (slots[slot] >= 0) {
+        entries[slots[slot]].value = std::move(value);
+        return;
+    }
+
+    // A slice key is copied out so the map doesn't keep its whole parent string alive
+    slots[slot] = (i32) entries.size();
+    entries.push_back(Entry{IS_STRING_SLICE(key) ? Value(std::string(textOf(key))) : key, std::move(value), hash});
+    count++;
+}
+
+bool MapObj::remove(const Value &key) {
+    if (count == 0)
+        return false;
+
+    size_t slot = slotFor(key, hashValue(key));
+    i32 position = slots[slot];
+
+    if (position < 0)
+        return false;
+
+    Entry &entry = entries[position];
+    entry.key = entry.value = NONE_VAL();
+    entry.removed = true;
+
+    slots[slot] = DELETED;
+    count--;
+    return true;
+}
+
+// Compacts the entries and reinserts them into a table of the given power of two size
+void MapObj::rebuild(size_t capacity) {
+    if (count != entries.size()) {
+        size_t kept = 0;
+
+        for (size_t index = 0; index < entries.size(); index++) {
+            if (!entries[index].removed) {
+                if (kept != index)
+                    entries[kept] = std::move(entries[index]);
+                kept++;
+            }
+        }
+
+        entries.resize(kept);
+    }
+
+    slots.assign(capacity, EMPTY);
+    size_t mask = capacity - 1;
+
+    for (size_t index = 0; index < entries.size(); index++) {
+        size_t slot = entries[index].hash & mask;
+
+        while (slots[slot] != EMPTY)
+            slot = (slot + 1) & mask;
+
+        slots[slot] = (i32) index;
+    }
+
+    entries.reserve(capacity * 2 / 3);
+}
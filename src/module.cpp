@@ -0,0 +1,503 @@
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include "module.h"
+#include "bytecode.h"
+
+// Bump when the meaning of existing opcodes or the layout below changes, adding opcodes is
+// already caught by the opcode count
+#define COMPILED_MODULE_VERSION 2
+#define COMPILED_MODULE_MAGIC "JAKEC"
+
+// Paths
+
+std::string findModule(const std::vector<std::string> &directories, const std::string &name) {
+    std::error_code error;
+
+    for (const std::string &directory : directories) {
+        std::filesystem::path candidate = std::filesystem::path(directory) / (name + MODULE_EXTENSION);
+
+        if (std::filesystem::is_regular_file(candidate, error))
+            return candidate.string();
+    }
+
+    return "";
+}
+
+std::vector<std::string> environmentModulePaths() {
+    std::vector<std::string> directories;
+    const char* variable = getenv("JAKEPATH");
+
+    if (variable == nullptr)
+        return directories;
+
+    std::string_view paths = variable;
+
+    while (!paths.empty()) {
+        size_t separator = paths.find(':');
+        std::string_view directory = paths.substr(0, separator);
+
+        if (!directory.empty())
+            directories.emplace_back(directory);
+
+        if (separator == std::string_view::npos)
+            break;
+
+        paths.remove_prefix(separator + 1);
+    }
+
+    return directories;
+}
+
+// Compiled modules
+
+struct SourceStamp {
+    u64 size = 0;
+    i64 modified = 0;
+};
+
+static bool sourceStamp(const std::string &path, SourceStamp &stamp) {
+    std::error_code error;
+
+    stamp.size = std::filesystem::file_size(path, error);
+    if (error)
+        return false;
+
+    stamp.modified = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+    return !error;
+}
+
+static std::string compiledPath(const std::string &sourcePath) {
+    return std::filesystem::path(sourcePath).replace_extension(COMPILED_MODULE_EXTENSION).string();
+}
+
+static u32 opcodeCount() {
+    return (u32) (sizeof(opcodeNames) / sizeof(*opcodeNames));
+}
+
+enum class ConstantTag : u8 {
+    None,
+    Number,
+    Boolean,
+    String,
+    Function
+};
+
+class ModuleWriter {
+public:
+    std::string out;
+
+    template <typename T>
+    void write(T value) {
+        out.append((const char*) &value, sizeof(T));
+    }
+
+    void writeString(const std::string &text) {
+        write((u32) text.size());
+        out += text;
+    }
+
+    // Only plain data constants can be written, the same ones FunctionObj::freeze allows
+    bool writeFunction(FunctionObj* function) {
+        if (function->lazy != nullptr)
+            return false;
+
+        writeString(function->name);
+        write((i32) function->argc);
+        write((i32) function->upValueCount);
+
+        Chunk &chunk = function->chunk;
+        write((u32) chunk.bytecode.size());
+        out.append((const char*) chunk.bytecode.data(), chunk.bytecode.size());
+
+        // Each line maps to the offset of its last instruction
+        write((u32) chunk.lineNumbers.size());
+        for (auto &[line, offset] : chunk.lineNumbers) {
+            write((i32) line);
+            write((i32) offset);
+        }
+
+        write((u32) chunk.handlers.size());
+        for (ExceptionHandler &handler : chunk.handlers) {
+            write((i32) handler.start);
+            write((i32) handler.end);
+            write((i32) handler.handler);
+            write((i32) handler.stackDepth);
+        }
+
+        write((u32) chunk.constants.size());
+        for (Value &constant : chunk.constants) {
+            switch (constant.type()) {
+                case ValueType::None:
+                    write(ConstantTag::None);
+                    break;
+
+                case ValueType::Number:
+                    write(ConstantTag::Number);
+                    write(AS_NUMBER(constant));
+                    break;
+
+                case ValueType::Boolean:
+                    write(ConstantTag::Boolean);
+                    write((u8) AS_BOOLEAN(constant));
+                    break;
+
+                case ValueType::String:
+                    write(ConstantTag::String);
+                    writeString(AS_STRING(constant));
+                    break;
+
+                case ValueType::Function:
+                    write(ConstantTag::Function);
+                    if (!writeFunction(AS_FUNCTION(constant).get()))
+                        return false;
+                    break;
+
+                default:
+                    return false;
+            }
+        }
+
+        return true;
+    }
+};
+
+// Every read is bounds checked, a truncated or corrupt file just fails to load
+class ModuleReader {
+public:
+    std::string_view in;
+    bool failed = false;
+
+    template <typename T>
+    T read() {
+        T value = T();
+
+        if (in.size() < sizeof(T)) {
+            failed = true;
+            return value;
+        }
+
+        memcpy(&value, in.data(), sizeof(T));
+        in.remove_prefix(sizeof(T));
+        return value;
+    }
+
+    bool readBytes(size_t count, std::string_view &bytes) {
+        if (in.size() < count) {
+            failed = true;
+            return false;
+        }
+
+        bytes = in.substr(0, count);
+        in.remove_prefix(count);
+        return true;
+    }
+
+    std::string readString() {
+        std::string_view bytes;
+        return readBytes(read<u32>(), bytes) ? std::string(bytes) : std::string();
+    }
+
+    FunctionValue readFunction() {
+        FunctionValue function = std::make_shared<FunctionObj>();
+        function->name = readString();
+        function->argc = read<i32>();
+        function->upValueCount = read<i32>();
+
+        if (function->argc < 0 || function->argc > UINT8_MAX || function->upValueCount < 0 || function->upValueCount > UINT8_COUNT)
+            return nullptr;
+
+        Chunk &chunk = function->chunk;
+        std::string_view bytecode;
+        if (!readBytes(read<u32>(), bytecode))
+            return nullptr;
+        chunk.bytecode.assign(bytecode.begin(), bytecode.end());
+
+        u32 lineCount = read<u32>();
+        for (u32 index = 0; index < lineCount && !failed; index++) {
+            i32 line = read<i32>();
+            i32 offset = read<i32>();
+            chunk.lineNumbers[line] = offset;
+        }
+
+        u32 handlerCount = read<u32>();
+        for (u32 index = 0; index < handlerCount && !failed; index++) {
+            ExceptionHandler handler;
+            handler.start = read<i32>();
+            handler.end = read<i32>();
+            handler.handler = read<i32>();
+            handler.stackDepth = read<i32>();
+            chunk.handlers.push_back(handler);
+        }
+
+        u32 constantCount = read<u32>();
+        for (u32 index = 0; index < constantCount && !failed; index++) {
+            switch (read<ConstantTag>()) {
+                case ConstantTag::None:
+                    chunk.constants.push_back(NONE_VAL());
+                    break;
+
+                case ConstantTag::Number:
+                    chunk.constants.push_back(NUMBER_VAL(read<double>()));
+                    break;
+
+                case ConstantTag::Boolean:
+                    chunk.constants.push_back(BOOLEAN_VAL(read<u8>() != 0));
+                    break;
+
+                case ConstantTag::String:
+                    chunk.constants.push_back(readString());
+                    break;
+
+                case ConstantTag::Function: {
+                    FunctionValue constant = readFunction();
+                    if (constant == nullptr)
+                        return nullptr;
+                    chunk.constants.push_back(constant);
+                    break;
+                }
+
+                default:
+                    failed = true;
+                    break;
+            }
+        }
+
+        if (failed || !checkHandlers(chunk) || !checkBytecode(function.get()))
+            return nullptr;
+
+        return function;
+    }
+
+private:
+    bool checkHandlers(Chunk &chunk) {
+        int size = (int) chunk.bytecode.size();
+
+        for (ExceptionHandler &handler : chunk.handlers) {
+            if (handler.start < 0 || handler.start > handler.end || handler.end > size)
+                return false;
+            if (handler.handler < 0 || handler.handler >= size)
+                return false;
+            if (handler.stackDepth < 0 || handler.stackDepth > UINT8_COUNT)
+                return false;
+        }
+
+        return true;
+    }
+
+    // The interpreter trusts its bytecode, so everything it would read without checking is
+    // checked here: operands stay inside the chunk, constants exist and have the type the
+    // instruction expects, upvalues exist, and jumps and handlers land on an instruction.
+    bool checkBytecode(FunctionObj* function) {
+        Chunk &chunk = function->chunk;
+        std::vector<u8> &code = chunk.bytecode;
+        size_t size = code.size();
+
+        std::vector<bool> boundaries(size, false);
+        std::vector<size_t> targets;
+
+        for (ExceptionHandler &handler : chunk.handlers)
+            targets.push_back((size_t) handler.handler);
+
+        size_t index = 0;
+        while (index < size) {
+            boundaries[index] = true;
+            u8 opcode = code[index];
+
+            auto operand = [&](size_t offset) -> int {
+                return index + offset < size ? code[index + offset] : -1;
+            };
+
+            auto isConstant = [&](int constant) {
+                return constant >= 0 && constant < (int) chunk.constants.size();
+            };
+
+            auto isString = [&](int constant) {
+                return isConstant(constant) && IS_STRING(chunk.constants[constant]);
+            };
+
+            auto isUpValue = [&](int slot) {
+                return slot >= 0 && slot < function->upValueCount;
+            };
+
+            switch (opcode) {
+                case OpConstant:
+                    if (!isConstant(operand(1)))
+                        return false;
+                    index += 2;
+                    break;
+
+                case OpDefineGlobal:
+                case OpGetGlobal:
+                case OpSetGlobal:
+                case OpClass:
+                case OpGetProperty:
+                case OpSetProperty:
+                case OpMethod:
+                case OpGetSuper:
+                case OpImport:
+                    if (!isString(operand(1)))
+                        return false;
+                    index += 2;
+                    break;
+
+                case OpGetLocal:
+                case OpSetLocal:
+                case OpCall:
+                case OpBuildList:
+                case OpBuildMap:
+                    if (operand(1) < 0)
+                        return false;
+                    index += 2;
+                    break;
+
+                case OpGetUpValue:
+                case OpSetUpValue:
+                    if (!isUpValue(operand(1)))
+                        return false;
+                    index += 2;
+                    break;
+
+                case OpJump:
+                case OpJumpIfTrue:
+                case OpJumpIfFalse:
+                case OpJumpBack: {
+                    if (operand(1) < 0 || operand(2) < 0)
+                        return false;
+
+                    size_t distance = (size_t) ((operand(2) << 8) | operand(1));
+                    size_t next = index + 3;
+
+                    if (opcode == OpJumpBack ? distance > next : next + distance >= size)
+                        return false;
+
+                    targets.push_back(opcode == OpJumpBack ? next - distance : next + distance);
+                    index = next;
+                    break;
+                }
+
+                case OpInvoke:
+                    if (!isString(operand(1)) || operand(2) < 0)
+                        return false;
+                    index += 3;
+                    break;
+
+                case OpClosure: {
+                    int constant = operand(1);
+                    if (!isConstant(constant) || !IS_FUNCTION(chunk.constants[constant]))
+                        return false;
+
+                    int upValueCount = AS_FUNCTION(chunk.constants[constant])->upValueCount;
+                    index += 2;
+
+                    for (int upValue = 0; upValue < upValueCount; upValue++, index += 2) {
+                        int isLocal = operand(0);
+                        int slot = operand(1);
+
+                        if (isLocal < 0 || isLocal > 1 || slot < 0 || (!isLocal && !isUpValue(slot)))
+                            return false;
+                    }
+                    break;
+                }
+
+                case OpAddAssign: {
+                    int setOp = operand(1);
+                    int slot = operand(2);
+
+                    if (setOp == OpSetLocal ? slot < 0 : setOp == OpSetUpValue ? !isUpValue(slot) : setOp != OpSetGlobal || !isString(slot))
+                        return false;
+
+                    index += 3;
+                    break;
+                }
+
+                default:
+                    if (opcode >= opcodeCount())
+                        return false;
+                    index += 1;
+                    break;
+            }
+        }
+
+        if (index != size)
+            return false;
+
+        for (size_t target : targets) {
+            if (!boundaries[target])
+                return false;
+        }
+
+        return true;
+    }
+};
+
+FunctionValue loadCompiledModule(const std::string &sourcePath) {
+    SourceStamp stamp;
+    if (!sourceStamp(sourcePath, stamp))
+        return nullptr;
+
+    std::ifstream file(compiledPath(sourcePath), std::ios::binary);
+    if (!file.is_open())
+        return nullptr;
+
+    std::stringstream stream;
+    stream << file.rdbuf();
+    std::string contents = stream.str();
+
+    ModuleReader reader;
+    reader.in = contents;
+
+    std::string_view magic;
+    if (!reader.readBytes(sizeof(COMPILED_MODULE_MAGIC) - 1, magic) || magic != COMPILED_MODULE_MAGIC)
+        return nullptr;
+
+    if (reader.read<u32>() != COMPILED_MODULE_VERSION || reader.read<u32>() != opcodeCount())
+        return nullptr;
+
+    if (reader.read<u64>() != stamp.size || reader.read<i64>() != stamp.modified || reader.failed)
+        return nullptr;
+
+    FunctionValue function = reader.readFunction();
+
+    if (function == nullptr || !reader.in.empty())
+        return nullptr;
+
+    return function;
+}
+
+// Written to a temporary file first so a reader never sees half of one
+bool saveCompiledModule(const std::string &sourcePath, FunctionValue function) {
+    SourceStamp stamp;
+    if (!sourceStamp(sourcePath, stamp))
+        return false;
+
+    ModuleWriter writer;
+    writer.out += COMPILED_MODULE_MAGIC;
+    writer.write((u32) COMPILED_MODULE_VERSION);
+    writer.write(opcodeCount());
+    writer.write(stamp.size);
+    writer.write(stamp.modified);
+
+    if (!writer.writeFunction(function.get()))
+        return false;
+
+    std::string path = compiledPath(sourcePath);
+    std::string temporary = path + ".tmp";
+
+    {
+        std::ofstream file(temporary, std::ios::binary | std::ios::trunc);
+        if (!file.is_open() || !file.write(writer.out.data(), writer.out.size()))
+            return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporary, path, error);
+
+    if (error) {
+        std::filesystem::remove(temporary, error);
+        return false;
+    }
+
+    return true;
+}
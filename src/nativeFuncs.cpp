@@ -1,8 +1,16 @@
+#include <algorithm>
 #include <cmath>
 #include <ctime>
 #include "common.h"
 #include "value.h"
 #include "nativeFuncs.h"
+#include "concurrency.h"
+#include "interpreter.h"
+#include "eventLoop.h"
+#include "file.h"
+#include "map.h"
+#include "typedArray.h"
+#include "output.h"
 
 #define NATIVE_RUNTIME_ERROR(msg) std::make_shared<ExceptionObj>(msg, ExceptionType::RuntimeError)
 #define ASSERT_ARG_COUNT(count) if (argc != count) return NATIVE_RUNTIME_ERROR(formatStr("Expected %d arguments, got %d", count, argc))
@@ -32,5 +40,821 @@ Value BuiltIn::nativeSqrt(int argc, Value argv[]) {
 Value BuiltIn::nativeClock(int argc, Value argv[]) {
     ASSERT_ARG_COUNT(0);
 
-    return NUMBER_VAL((double) clock());
-}
\ No newline at end of file
+    return NUMBER_VAL((double) clock() / CLOCKS_PER_SEC);
+}
+// Concurrency
+
+Value BuiltIn::nativeSpawn(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    if (argc < 1)
+        return NATIVE_RUNTIME_ERROR("Expected a function to spawn");
+
+    ASSERT_TYPE(0, IS_CLOSURE, "Expected argument 1 as function");
+
+    std::string error;
+    ThreadValue thread = spawnThread(interpreter, argv[0], argc - 1, argv + 1, error);
+
+    if (thread == nullptr)
+        return NATIVE_RUNTIME_ERROR(error);
+
+    return thread;
+}
+
+Value BuiltIn::nativeJoin(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_THREAD, "Expected argument 1 as thread");
+
+    return AS_THREAD(argv[0])->join(interpreter.heapAccount(), [&]() { return interpreter.timedOut(); });
+}
+
+Value BuiltIn::nativeChannel(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_NUMBER, "Expected argument 1 as number");
+
+    if (AS_NUMBER(argv[0]) < 1 || AS_NUMBER(argv[0]) > (1 << 24))
+        return NATIVE_RUNTIME_ERROR("Channel capacity must be between 1 and 16777216");
+
+    size_t capacity = (size_t) AS_NUMBER(argv[0]);
+    HeapAccount* account = interpreter.heapAccount();
+
+    if (!account->canAllocate(Channel::footprint(capacity)))
+        return NATIVE_RUNTIME_ERROR("Heap quota exceeded");
+
+    return std::make_shared<ChannelObj>(capacity, account);
+}
+
+Value BuiltIn::nativeSend(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_CHANNEL, "Expected argument 1 as channel");
+
+    // Nobody is charged for a message in flight, the receiver copies it into its own heap
+    TransferMemo memo;
+    Value message = transferValue(argv[1], memo, nullptr);
+
+    if (IS_EXCEPTION(message))
+        return message;
+
+    if (!AS_CHANNEL(argv[0])->channel.send(message, [&]() { return interpreter.timedOut(); }))
+        return NATIVE_RUNTIME_ERROR("Script timed out");
+
+    return NONE_VAL();
+}
+
+Value BuiltIn::nativeRecv(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_CHANNEL, "Expected argument 1 as channel");
+
+    Value message;
+    if (!AS_CHANNEL(argv[0])->channel.recv(message, [&]() { return interpreter.timedOut(); }))
+        return NATIVE_RUNTIME_ERROR("Script timed out");
+
+    TransferMemo memo;
+    return transferValue(message, memo, interpreter.heapAccount());
+}
+
+// Coroutines
+
+Value BuiltIn::nativeCoroutine(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_CLOSURE, "Expected argument 1 as function");
+
+    return interpreter.makeCoroutine(AS_CLOSURE(argv[0]));
+}
+
+Value BuiltIn::nativeDone(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_COROUTINE, "Expected argument 1 as coroutine");
+
+    return BOOLEAN_VAL(AS_COROUTINE(argv[0])->state == CoroutineState::Done);
+}
+
+// Lists
+
+Value BuiltIn::nativePush(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_LIST, "Expected argument 1 as list");
+
+    ValueList &items = AS_LIST(argv[0])->items;
+    items.push_back(argv[1]);
+
+    return NUMBER_VAL((double) items.size());
+}
+
+Value BuiltIn::nativePop(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_LIST, "Expected argument 1 as list");
+
+    ValueList &items = AS_LIST(argv[0])->items;
+
+    if (items.empty())
+        return NATIVE_RUNTIME_ERROR("Cannot pop from an empty list");
+
+    Value last = std::move(items.back());
+    items.pop_back();
+
+    return last;
+}
+
+Value BuiltIn::nativeLen(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    if (IS_LIST(argv[0]))
+        return NUMBER_VAL((double) AS_LIST(argv[0])->items.size());
+
+    if (IS_MAP(argv[0]))
+        return NUMBER_VAL((double) AS_MAP(argv[0])->size());
+
+    if (IS_TYPED_ARRAY(argv[0]))
+        return NUMBER_VAL((double) AS_TYPED_ARRAY(argv[0])->length());
+
+    if (IS_STRING_BUILDER(argv[0]))
+        return NUMBER_VAL((double) AS_STRING_BUILDER(argv[0])->text.size());
+
+    if (IS_TEXT(argv[0]))
+        return NUMBER_VAL((double) textOf(argv[0]).size());
+
+    return NATIVE_RUNTIME_ERROR("Expected argument 1 as list, map, array or string");
+}
+
+// Negative positions count back from the end, the result is clamped to [0, size] like Python's
+// slices
+static size_t clampPosition(double position, size_t size) {
+    if (position < 0) position += (double) size;
+    return (size_t) std::clamp(std::floor(position), 0.0, (double) size);
+}
+
+// slice(list, start, end) copies [start, end)
+Value BuiltIn::nativeSlice(int argc, Value argv[]) {
+    if (argc != 2 && argc != 3)
+        return NATIVE_RUNTIME_ERROR(formatStr("Expected 2 or 3 arguments, got %d", argc));
+
+    ASSERT_TYPE(0, IS_LIST, "Expected argument 1 as list");
+    ASSERT_TYPE(1, IS_NUMBER, "Expected argument 2 as number");
+
+    if (argc == 3)
+        ASSERT_TYPE(2, IS_NUMBER, "Expected argument 3 as number");
+
+    ValueList &items = AS_LIST(argv[0])->items;
+
+    size_t start = clampPosition(AS_NUMBER(argv[1]), items.size());
+    size_t end = argc == 3 ? clampPosition(AS_NUMBER(argv[2]), items.size()) : items.size();
+
+    // The copy is charged to the same heap as the original
+    ValueList copy(items.get_allocator());
+    if (start < end)
+        copy.assign(items.begin() + start, items.begin() + end);
+
+    return std::make_shared<ListObj>(std::move(copy));
+}
+
+// Maps
+
+Value BuiltIn::nativeHas(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_MAP, "Expected argument 1 as map");
+
+    return BOOLEAN_VAL(isHashable(argv[1]) && AS_MAP(argv[0])->find(argv[1]) != nullptr);
+}
+
+// get(map, key, default) is the lookup for keys that may be missing
+Value BuiltIn::nativeGet(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(3);
+
+    ASSERT_TYPE(0, IS_MAP, "Expected argument 1 as map");
+
+    Value* value = isHashable(argv[1]) ? AS_MAP(argv[0])->find(argv[1]) : nullptr;
+
+    return value != nullptr ? *value : argv[2];
+}
+
+Value BuiltIn::nativeRemove(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_MAP, "Expected argument 1 as map");
+
+    return BOOLEAN_VAL(isHashable(argv[1]) && AS_MAP(argv[0])->remove(argv[1]));
+}
+
+// keys and values return lists in insertion order, charged to the map's heap
+static Value mapColumn(MapObj* map, bool keys) {
+    ValueList column(map->entries.get_allocator());
+    column.reserve(map->size());
+
+    for (MapObj::Entry &entry : map->entries) {
+        if (!entry.removed)
+            column.push_back(keys ? entry.key : entry.value);
+    }
+
+    return std::make_shared<ListObj>(std::move(column));
+}
+
+Value BuiltIn::nativeKeys(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_MAP, "Expected argument 1 as map");
+
+    return mapColumn(AS_MAP(argv[0]).get(), true);
+}
+
+Value BuiltIn::nativeValues(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_MAP, "Expected argument 1 as map");
+
+    return mapColumn(AS_MAP(argv[0]).get(), false);
+}
+
+// Typed arrays
+
+// A zeroed array of the same type and length, charged to the same heap as the original
+static TypedArrayValue arrayLike(TypedArrayObj* array) {
+    return std::make_shared<TypedArrayObj>(array->elementType, array->length(), array->float64.get_allocator().account);
+}
+
+// The kernel is called with the Float64 or Int32 data of the arrays, which must match
+template <typename Kernel>
+static Value arrayElementwise(int argc, Value argv[], Kernel kernel) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_TYPED_ARRAY, "Expected argument 1 as typed array");
+    ASSERT_TYPE(1, IS_TYPED_ARRAY, "Expected argument 2 as typed array");
+
+    TypedArrayObj* a = AS_TYPED_ARRAY(argv[0]).get();
+    TypedArrayObj* b = AS_TYPED_ARRAY(argv[1]).get();
+
+    if (a->elementType != b->elementType || a->length() != b->length())
+        return NATIVE_RUNTIME_ERROR("Arrays must have the same type and length");
+
+    TypedArrayValue result = arrayLike(a);
+
+    if (a->elementType == ElementType::Float64)
+        kernel(a->float64.data(), b->float64.data(), result->float64.data(), a->length());
+    else
+        kernel(a->int32.data(), b->int32.data(), result->int32.data(), a->length());
+
+    return result;
+}
+
+template <typename Kernel>
+static Value arrayReduce(int argc, Value argv[], bool needsElements, Kernel kernel) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_TYPED_ARRAY, "Expected argument 1 as typed array");
+
+    TypedArrayObj* array = AS_TYPED_ARRAY(argv[0]).get();
+
+    if (needsElements && array->length() == 0)
+        return NATIVE_RUNTIME_ERROR("Array is empty");
+
+    if (array->elementType == ElementType::Float64)
+        return NUMBER_VAL(kernel(array->float64.data(), array->length()));
+
+    return NUMBER_VAL(kernel(array->int32.data(), array->length()));
+}
+
+Value BuiltIn::nativeAdd(int argc, Value argv[]) {
+    return arrayElementwise(argc, argv, [](auto a, auto b, auto out, size_t count) { Kernels::add(a, b, out, count); });
+}
+
+Value BuiltIn::nativeMul(int argc, Value argv[]) {
+    return arrayElementwise(argc, argv, [](auto a, auto b, auto out, size_t count) { Kernels::mul(a, b, out, count); });
+}
+
+Value BuiltIn::nativeScale(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_TYPED_ARRAY, "Expected argument 1 as typed array");
+    ASSERT_TYPE(1, IS_NUMBER, "Expected argument 2 as number");
+
+    TypedArrayObj* array = AS_TYPED_ARRAY(argv[0]).get();
+    TypedArrayValue result = arrayLike(array);
+
+    if (array->elementType == ElementType::Float64)
+        Kernels::scale(array->float64.data(), AS_NUMBER(argv[1]), result->float64.data(), array->length());
+    else
+        Kernels::scale(array->int32.data(), toInt32(AS_NUMBER(argv[1])), result->int32.data(), array->length());
+
+    return result;
+}
+
+Value BuiltIn::nativeDot(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_TYPED_ARRAY, "Expected argument 1 as typed array");
+    ASSERT_TYPE(1, IS_TYPED_ARRAY, "Expected argument 2 as typed array");
+
+    TypedArrayObj* a = AS_TYPED_ARRAY(argv[0]).get();
+    TypedArrayObj* b = AS_TYPED_ARRAY(argv[1]).get();
+
+    if (a->elementType != b->elementType || a->length() != b->length())
+        return NATIVE_RUNTIME_ERROR("Arrays must have the same type and length");
+
+    if (a->elementType == ElementType::Float64)
+        return NUMBER_VAL(Kernels::dot(a->float64.data(), b->float64.data(), a->length()));
+
+    return NUMBER_VAL(Kernels::dot(a->int32.data(), b->int32.data(), a->length()));
+}
+
+Value BuiltIn::nativeSum(int argc, Value argv[]) {
+    return arrayReduce(argc, argv, false, [](auto data, size_t count) { return Kernels::sum(data, count); });
+}
+
+Value BuiltIn::nativeMin(int argc, Value argv[]) {
+    return arrayReduce(argc, argv, true, [](auto data, size_t count) { return Kernels::min(data, count); });
+}
+
+Value BuiltIn::nativeMax(int argc, Value argv[]) {
+    return arrayReduce(argc, argv, true, [](auto data, size_t count) { return Kernels::max(data, count); });
+}
+
+Value BuiltIn::nativePrefixSum(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_TYPED_ARRAY, "Expected argument 1 as typed array");
+
+    TypedArrayObj* array = AS_TYPED_ARRAY(argv[0]).get();
+    TypedArrayValue result = arrayLike(array);
+
+    if (array->elementType == ElementType::Float64)
+        Kernels::prefixSum(array->float64.data(), result->float64.data(), array->length());
+    else
+        Kernels::prefixSum(array->int32.data(), result->int32.data(), array->length());
+
+    return result;
+}
+
+Value BuiltIn::nativeToList(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_TYPED_ARRAY, "Expected argument 1 as typed array");
+
+    TypedArrayObj* array = AS_TYPED_ARRAY(argv[0]).get();
+    ValueList items(array->float64.get_allocator());
+    items.reserve(array->length());
+
+    for (size_t index = 0; index < array->length(); index++)
+        items.push_back(NUMBER_VAL(array->get(index)));
+
+    return std::make_shared<ListObj>(std::move(items));
+}
+
+// float64Array(length) is zero filled, float64Array(list) copies a list of numbers
+static Value makeTypedArray(Interpreter &interpreter, ElementType type, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    if (IS_NUMBER(argv[0])) {
+        double length = AS_NUMBER(argv[0]);
+
+        if (length < 0 || length != std::floor(length) || length > (double) UINT32_MAX)
+            return NATIVE_RUNTIME_ERROR("Array length must be a whole number between 0 and 4294967295");
+
+        if (!interpreter.heapAccount()->canAllocate((size_t) length * (type == ElementType::Float64 ? sizeof(double) : sizeof(i32))))
+            return NATIVE_RUNTIME_ERROR("Heap quota exceeded");
+
+        return std::make_shared<TypedArrayObj>(type, (size_t) length, interpreter.heapAccount());
+    }
+
+    ASSERT_TYPE(0, IS_LIST, "Expected argument 1 as number or list");
+
+    ValueList &items = AS_LIST(argv[0])->items;
+    TypedArrayValue array = std::make_shared<TypedArrayObj>(type, items.size(), interpreter.heapAccount());
+
+    for (size_t index = 0; index < items.size(); index++) {
+        if (!IS_NUMBER(items[index]))
+            return NATIVE_RUNTIME_ERROR(formatStr("%s elements must be numbers", array->typeName()));
+
+        array->set(index, AS_NUMBER(items[index]));
+    }
+
+    return array;
+}
+
+Value BuiltIn::nativeFloat64Array(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    return makeTypedArray(interpreter, ElementType::Float64, argc, argv);
+}
+
+Value BuiltIn::nativeInt32Array(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    return makeTypedArray(interpreter, ElementType::Int32, argc, argv);
+}
+
+// String builders
+
+// append(builder, values...) adds each value as print would show it, returns the builder
+Value BuiltIn::nativeAppend(int argc, Value argv[]) {
+    if (argc < 1)
+        return NATIVE_RUNTIME_ERROR("Expected a string builder to append to");
+
+    ASSERT_TYPE(0, IS_STRING_BUILDER, "Expected argument 1 as string builder");
+
+    BuilderString &text = AS_STRING_BUILDER(argv[0])->text;
+    std::string formatted;
+
+    for (int index = 1; index < argc; index++) {
+        if (IS_TEXT(argv[index])) {
+            text += textOf(argv[index]);
+        } else {
+            formatted.clear();
+            formatValue(formatted, argv[index]);
+            text += formatted;
+        }
+    }
+
+    return argv[0];
+}
+
+// The builder keeps its contents and can go on being appended to
+Value BuiltIn::nativeBuild(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_STRING_BUILDER, "Expected argument 1 as string builder");
+
+    BuilderString &text = AS_STRING_BUILDER(argv[0])->text;
+    return StringValue(text.data(), text.size());
+}
+
+Value BuiltIn::nativeStringBuilder(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(0);
+
+    return std::make_shared<StringBuilderObj>(interpreter.heapAccount());
+}
+
+// Strings
+
+// Slice of [start, start + length) in value's text, sharing the parent when value is a slice
+static StringSlice sliceOf(const Value &value, size_t start, size_t length) {
+    if (IS_STRING_SLICE(value)) {
+        const StringSlice &slice = AS_STRING_SLICE(value);
+        return StringSlice(slice.parent, slice.offset + start, length);
+    }
+
+    return StringSlice(std::make_shared<const StringValue>(AS_STRING(value)), start, length);
+}
+
+// substring(s, start, end) takes [start, end) with the same positions as slice. Substrings of a
+// slice are slices of the same parent, a plain string only has the part asked for copied out,
+// which is never more than making it a parent would copy.
+Value BuiltIn::nativeSubstring(int argc, Value argv[]) {
+    if (argc != 2 && argc != 3)
+        return NATIVE_RUNTIME_ERROR(formatStr("Expected 2 or 3 arguments, got %d", argc));
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+    ASSERT_TYPE(1, IS_NUMBER, "Expected argument 2 as number");
+
+    if (argc == 3)
+        ASSERT_TYPE(2, IS_NUMBER, "Expected argument 3 as number");
+
+    std::string_view text = textOf(argv[0]);
+
+    size_t start = clampPosition(AS_NUMBER(argv[1]), text.size());
+    size_t end = argc == 3 ? clampPosition(AS_NUMBER(argv[2]), text.size()) : text.size();
+    size_t length = start < end ? end - start : 0;
+
+    if (IS_STRING(argv[0]))
+        return StringValue(text.substr(start, length));
+
+    return sliceOf(argv[0], start, length);
+}
+
+// split(s, separator) returns the fields as slices of one parent, a plain string is copied
+// into it once and a slice's parent is reused, so no field allocates
+Value BuiltIn::nativeSplit(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+    ASSERT_TYPE(1, IS_TEXT, "Expected argument 2 as string");
+
+    std::string_view separator = textOf(argv[1]);
+
+    if (separator.empty())
+        return NATIVE_RUNTIME_ERROR("Separator can't be empty");
+
+    StringSlice whole = sliceOf(argv[0], 0, textOf(argv[0]).size());
+    std::string_view text = whole.view();
+
+    ListValue fields = std::make_shared<ListObj>(interpreter.heapAccount());
+    size_t start = 0;
+
+    for (;;) {
+        size_t found = text.find(separator, start);
+        size_t end = found == std::string_view::npos ? text.size() : found;
+
+        fields->items.push_back(StringSlice(whole.parent, whole.offset + start, end - start));
+
+        if (found == std::string_view::npos)
+            break;
+
+        start = found + separator.size();
+    }
+
+    return fields;
+}
+
+// find(s, needle, start) is the position of the first match at or after start, -1 if none
+Value BuiltIn::nativeFind(int argc, Value argv[]) {
+    if (argc != 2 && argc != 3)
+        return NATIVE_RUNTIME_ERROR(formatStr("Expected 2 or 3 arguments, got %d", argc));
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+    ASSERT_TYPE(1, IS_TEXT, "Expected argument 2 as string");
+
+    if (argc == 3)
+        ASSERT_TYPE(2, IS_NUMBER, "Expected argument 3 as number");
+
+    std::string_view text = textOf(argv[0]);
+    size_t start = argc == 3 ? clampPosition(AS_NUMBER(argv[2]), text.size()) : 0;
+    size_t found = text.find(textOf(argv[1]), start);
+
+    return NUMBER_VAL(found == std::string_view::npos ? -1.0 : (double) found);
+}
+
+// Position of the character at index, negative indices count back from the end
+static bool charIndex(int argc, Value argv[], size_t &position, Value &error) {
+    if (argc != 2) {
+        error = NATIVE_RUNTIME_ERROR(formatStr("Expected %d arguments, got %d", 2, argc));
+        return false;
+    }
+
+    if (!IS_TEXT(argv[0])) {
+        error = NATIVE_RUNTIME_ERROR("Expected argument 1 as string");
+        return false;
+    }
+
+    if (!IS_NUMBER(argv[1]) || AS_NUMBER(argv[1]) != std::floor(AS_NUMBER(argv[1]))) {
+        error = NATIVE_RUNTIME_ERROR("String index must be a whole number");
+        return false;
+    }
+
+    double size = (double) textOf(argv[0]).size();
+    double index = AS_NUMBER(argv[1]);
+
+    if (index < 0)
+        index += size;
+
+    if (index < 0 || index >= size) {
+        error = NATIVE_RUNTIME_ERROR("String index out of range");
+        return false;
+    }
+
+    position = (size_t) index;
+    return true;
+}
+
+// charAt(s, index) is a one character string, short enough to never allocate
+Value BuiltIn::nativeCharAt(int argc, Value argv[]) {
+    size_t position;
+    Value error;
+
+    if (!charIndex(argc, argv, position, error))
+        return error;
+
+    return StringValue(1, textOf(argv[0])[position]);
+}
+
+// charCode(s, index) is the byte at index as a number
+Value BuiltIn::nativeCharCode(int argc, Value argv[]) {
+    size_t position;
+    Value error;
+
+    if (!charIndex(argc, argv, position, error))
+        return error;
+
+    return NUMBER_VAL((double) (u8) textOf(argv[0])[position]);
+}
+
+// str(value) is the text print would show, numbers in the shortest form that reads back the
+// same. A slice comes back as a string of its own.
+Value BuiltIn::nativeStr(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    if (IS_STRING(argv[0]))
+        return argv[0];
+
+    std::string text;
+    formatValue(text, argv[0]);
+
+    return text;
+}
+
+// num(s) parses a decimal number, none when s isn't one so bad input can be checked for
+Value BuiltIn::nativeNum(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    if (IS_NUMBER(argv[0]))
+        return argv[0];
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+
+    double value;
+
+    if (!parseNumber(textOf(argv[0]), value))
+        return NONE_VAL();
+
+    return NUMBER_VAL(value);
+}
+
+// Files
+
+Value BuiltIn::nativeOpen(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+
+    FileValue file = std::make_shared<FileObj>(std::string(textOf(argv[0])));
+
+    if (!file->open())
+        return NATIVE_RUNTIME_ERROR(formatStr("Could not open file '%s'", file->path.c_str()));
+
+    return file;
+}
+
+// Returns none at the end of the file
+Value BuiltIn::nativeReadLine(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_FILE, "Expected argument 1 as file");
+
+    std::optional<StringSlice> line = AS_FILE(argv[0])->readLine();
+
+    if (!line)
+        return NONE_VAL();
+
+    return *line;
+}
+
+Value BuiltIn::nativeClose(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    if (IS_FILE(argv[0])) {
+        AS_FILE(argv[0])->close();
+    } else if (IS_MAPPED_FILE(argv[0])) {
+        AS_MAPPED_FILE(argv[0])->unmap();
+    } else {
+        return NATIVE_RUNTIME_ERROR("Expected argument 1 as file");
+    }
+
+    return NONE_VAL();
+}
+
+Value BuiltIn::nativeMapFile(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+
+    MappedFileValue file = std::make_shared<MappedFileObj>(std::string(textOf(argv[0])));
+
+    if (!file->map())
+        return NATIVE_RUNTIME_ERROR(formatStr("Could not map file '%s'", file->path.c_str()));
+
+    return file;
+}
+
+Value BuiltIn::nativeReadAt(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(3);
+
+    ASSERT_TYPE(0, IS_MAPPED_FILE, "Expected argument 1 as mapped file");
+    ASSERT_TYPE(1, IS_NUMBER, "Expected argument 2 as number");
+    ASSERT_TYPE(2, IS_NUMBER, "Expected argument 3 as number");
+
+    MappedFileValue file = AS_MAPPED_FILE(argv[0]);
+    double offset = AS_NUMBER(argv[1]);
+    double length = AS_NUMBER(argv[2]);
+
+    // NaN fails every comparison, and casting it or anything out of range to size_t is undefined
+    if (!std::isfinite(offset) || !std::isfinite(length))
+        return NATIVE_RUNTIME_ERROR("Read is outside of the file");
+
+    if (offset < 0 || length < 0 || offset > file->size())
+        return NATIVE_RUNTIME_ERROR("Read is outside of the file");
+
+    size_t start = (size_t) offset;
+    size_t count = (size_t) std::min(length, (double) (file->size() - start));
+    return StringValue(file->data() + start, count);
+}
+
+Value BuiltIn::nativeFileSize(int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    if (IS_FILE(argv[0]))
+        return NUMBER_VAL((double) AS_FILE(argv[0])->size());
+
+    if (IS_MAPPED_FILE(argv[0]))
+        return NUMBER_VAL((double) AS_MAPPED_FILE(argv[0])->size());
+
+    return NATIVE_RUNTIME_ERROR("Expected argument 1 as file");
+}
+
+// Event loop
+
+Value BuiltIn::nativeAsync(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    if (argc < 1)
+        return NATIVE_RUNTIME_ERROR("Expected a function to run");
+
+    ASSERT_TYPE(0, IS_CLOSURE, "Expected argument 1 as function");
+
+    ClosureValue closure = AS_CLOSURE(argv[0]);
+    if (closure->function->argc != argc - 1)
+        return NATIVE_RUNTIME_ERROR(formatStr("Expected %d arguments, got %d", closure->function->argc, argc - 1));
+
+    CoroutineValue task = interpreter.makeCoroutine(closure);
+    interpreter.eventLoop().addTask(task, std::vector<Value>(argv + 1, argv + argc));
+
+    return task;
+}
+
+Value BuiltIn::nativeWait(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(0);
+
+    EventLoop &loop = interpreter.eventLoop();
+
+    if (loop.inTask())
+        return NATIVE_RUNTIME_ERROR("Cannot wait from inside a task");
+
+    if (!loop.run(interpreter))
+        return interpreter.propagateError();
+
+    return NONE_VAL();
+}
+
+static Value ioResultValue(const IoResult &result) {
+    if (!result.ok)
+        return NATIVE_RUNTIME_ERROR(result.error);
+
+    if (result.isNumber)
+        return NUMBER_VAL(result.number);
+
+    return result.data;
+}
+
+Value BuiltIn::nativeReadFile(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+
+    EventLoop &loop = interpreter.eventLoop();
+
+    if (!loop.inTask())
+        return ioResultValue(EventLoop::readFileNow(std::string(textOf(argv[0]))));
+
+    loop.readFile(std::string(textOf(argv[0])));
+    interpreter.suspend();
+    return NONE_VAL();
+}
+
+Value BuiltIn::nativeWriteFile(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(2);
+
+    ASSERT_TYPE(0, IS_TEXT, "Expected argument 1 as string");
+    ASSERT_TYPE(1, IS_TEXT, "Expected argument 2 as string");
+
+    EventLoop &loop = interpreter.eventLoop();
+
+    if (!loop.inTask())
+        return ioResultValue(EventLoop::writeFileNow(std::string(textOf(argv[0])), std::string(textOf(argv[1]))));
+
+    loop.writeFile(std::string(textOf(argv[0])), std::string(textOf(argv[1])));
+    interpreter.suspend();
+    return NONE_VAL();
+}
+
+Value BuiltIn::nativeSleep(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(1);
+
+    ASSERT_TYPE(0, IS_NUMBER, "Expected argument 1 as number");
+
+    EventLoop &loop = interpreter.eventLoop();
+
+    // Sleeps in steps so the deadline can cut it short
+    if (!loop.inTask()) {
+        auto due = std::chrono::steady_clock::now() + std::chrono::microseconds((i64) (AS_NUMBER(argv[0]) * 1000));
+
+        while (std::chrono::steady_clock::now() < due) {
+            if (interpreter.timedOut())
+                return NATIVE_RUNTIME_ERROR("Script timed out");
+
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(due - std::chrono::steady_clock::now(), std::chrono::milliseconds(10)));
+        }
+
+        return NONE_VAL();
+    }
+
+    loop.sleep(AS_NUMBER(argv[0]));
+    interpreter.suspend();
+    return NONE_VAL();
+}
+
+// Output
+
+Value BuiltIn::nativeFlush(Interpreter &interpreter, void* userData, int argc, Value argv[]) {
+    ASSERT_ARG_COUNT(0);
+
+    interpreter.output.flush();
+    return NONE_VAL();
+}
@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <chrono>
+#include "opcodeStats.h"
+#include "bytecode.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <x86intrin.h>
+    #define HAS_RDTSC
+#endif
+
+#define HOT_OFFSET_COUNT 20
+
+OpcodeStats::OpcodeStats() {
+    reset();
+}
+
+void OpcodeStats::reset() {
+    memset(opcodeCounts, 0, sizeof(opcodeCounts));
+    memset(opcodeCycles, 0, sizeof(opcodeCycles));
+    memset(cycleHistogram, 0, sizeof(cycleHistogram));
+
+    functions.clear();
+    lastFunction = nullptr;
+    lastStats = nullptr;
+    hasPrevious = false;
+}
+
+void OpcodeStats::endRun() {
+    hasPrevious = false;
+}
+
+OpcodeStats::FunctionStats& OpcodeStats::functionStats(const FunctionValue &function) {
+    FunctionStats &stats = functions[function.get()];
+
+    if (stats.function == nullptr) {
+        stats.function = function;
+        stats.offsetCounts.resize(function->chunk.bytecode.size());
+    }
+
+    return stats;
+}
+
+u64 OpcodeStats::readCycles() {
+#ifdef HAS_RDTSC
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static const char* opcodeName(int opcode) {
+    return opcode < (int) (sizeof(opcodeNames) / sizeof(*opcodeNames)) ? opcodeNames[opcode] : "Unknown";
+}
+
+static std::string functionName(const FunctionValue &function) {
+    return function->name.size() ? function->name : "<script>";
+}
+
+void OpcodeStats::report(FILE* out) {
+    u64 total = 0;
+    for (u64 count : opcodeCounts) total += count;
+
+    if (!total)
+        return;
+
+#ifdef OPCODECYCLES
+    #ifdef HAS_RDTSC
+        const char* unit = "cycles";
+    #else
+        const char* unit = "ns";
+    #endif
+#endif
+
+    // Opcodes
+
+    std::vector<int> opcodes;
+    for (int opcode = 0; opcode < UINT8_COUNT; opcode++) {
+        if (opcodeCounts[opcode]) opcodes.push_back(opcode);
+    }
+
+    std::sort(opcodes.begin(), opcodes.end(), [this](int a, int b) { return opcodeCounts[a] > opcodeCounts[b]; });
+
+    fprintf(out, ">== Opcodes (%llu executed) ==<\n", (unsigned long long) total);
+
+    for (int opcode : opcodes) {
+        fprintf(out, "%-14s %14llu %6.2f%%", opcodeName(opcode), (unsigned long long) opcodeCounts[opcode], 100.0 * opcodeCounts[opcode] / total);
+
+#ifdef OPCODECYCLES
+        fprintf(out, " %10.1f %s/op", (double) opcodeCycles[opcode] / opcodeCounts[opcode], unit);
+#endif
+
+        fprintf(out, "\n");
+    }
+
+#ifdef OPCODECYCLES
+    fprintf(out, "\n>== Timing histogram (%s, log2 buckets: <2 <4 <8 ...) ==<\n", unit);
+
+    for (int opcode : opcodes) {
+        fprintf(out, "%-14s", opcodeName(opcode));
+
+        for (int bucket = 0; bucket < CYCLE_BUCKETS; bucket++)
+            fprintf(out, " %llu", (unsigned long long) cycleHistogram[opcode][bucket]);
+
+        fprintf(out, "\n");
+    }
+#endif
+
+    // Functions
+
+    std::vector<FunctionStats*> byFunction;
+    for (auto &[pointer, stats] : functions) byFunction.push_back(&stats);
+
+    std::sort(byFunction.begin(), byFunction.end(), [](FunctionStats* a, FunctionStats* b) { return a->total > b->total; });
+
+    fprintf(out, "\n>== Functions ==<\n");
+
+    for (FunctionStats* stats : byFunction) {
+        fprintf(out, "%-24s %14llu %6.2f%%\n", functionName(stats->function).c_str(), (unsigned long long) stats->total, 100.0 * stats->total / total);
+    }
+
+    // Offsets
+
+    struct HotOffset {
+        FunctionStats* stats;
+        int offset;
+        u64 count;
+    };
+
+    std::vector<HotOffset> offsets;
+    for (FunctionStats* stats : byFunction) {
+        for (int offset = 0; offset < (signed) stats->offsetCounts.size(); offset++) {
+            if (stats->offsetCounts[offset]) offsets.push_back(HotOffset{stats, offset, stats->offsetCounts[offset]});
+        }
+    }
+
+    size_t hotCount = std::min(offsets.size(), (size_t) HOT_OFFSET_COUNT);
+    std::partial_sort(offsets.begin(), offsets.begin() + hotCount, offsets.end(), [](const HotOffset &a, const HotOffset &b) { return a.count > b.count; });
+
+    fprintf(out, "\n>== Hot offsets ==<\n");
+
+    for (size_t index = 0; index < hotCount; index++) {
+        HotOffset &hot = offsets[index];
+        Chunk &chunk = hot.stats->function->chunk;
+
+        fprintf(out, "%-24s %04d line %-5d %-14s %14llu\n", functionName(hot.stats->function).c_str(), hot.offset, 
+            chunk.getLineNumber(hot.offset), opcodeName(chunk.bytecode[hot.offset]), (unsigned long long) hot.count);
+    }
+
+    fprintf(out, ">===============<\n");
+}
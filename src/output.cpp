@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdio>
+#include <unistd.h>
+#include "output.h"
+#include "interpreter.h"
+#include "file.h"
+#include "map.h"
+#include "typedArray.h"
+#include "module.h"
+
+// Formatting
+
+// Shortest text that reads back as the same number, except for whole numbers that doubles hold
+// exactly: shortest picks an exponent whenever it's fewer characters, 200000 would be 2e+05
+void formatNumber(std::string &out, double number) {
+    char text[32];
+    std::to_chars_result result;
+
+    if (std::trunc(number) == number && std::fabs(number) < 9007199254740992.0)
+        result = std::to_chars(text, text + sizeof(text), number, std::chars_format::fixed);
+    else
+        result = std::to_chars(text, text + sizeof(text), number);
+
+    out.append(text, result.ptr - text);
+}
+
+// Containers quote the strings they hold and print a container that contains itself as [...]
+// or {...}
+static void appendValue(std::string &out, const Value &value, std::vector<const void*> &enclosing, bool nested) {
+    switch (value.type()) {
+        case ValueType::Number:
+            formatNumber(out, AS_NUMBER(value));
+            break;
+
+        case ValueType::Boolean:
+            out += AS_BOOLEAN(value) ? "true" : "false";
+            break;
+
+        case ValueType::None:
+            out += "None";
+            break;
+
+        case ValueType::String:
+        case ValueType::StringSlice:
+            if (nested) {
+                out += '"';
+                out += textOf(value);
+                out += '"';
+            } else {
+                out += textOf(value);
+            }
+            break;
+
+        case ValueType::Function:
+            if (!AS_FUNCTION(value)->name.size()) {
+                out += "<script>";
+            } else {
+                out += "<fn " + AS_FUNCTION(value)->name + ">";
+            }
+            break;
+
+        case ValueType::Closure:
+            if (!AS_CLOSURE(value)->function->name.size()) {
+                out += "<script>";
+            } else {
+                out += "<fn " + AS_CLOSURE(value)->function->name + ">";
+            }
+            break;
+
+        case ValueType::NativeFunc:
+            out += "<native fn>";
+            break;
+
+        case ValueType::UpValuePtr:
+            out += "<upvalue>";
+            break;
+
+        case ValueType::Class:
+            out += "<class " + AS_CLASS(value)->name + ">";
+            break;
+
+        case ValueType::Instance:
+            out += "<" + AS_INSTANCE(value)->klass->name + " instance>";
+            break;
+
+        case ValueType::BoundMethod:
+            if (!AS_BOUND_METHOD(value)->method->function->name.size()) {
+                out += "<bound script>";
+            } else {
+                out += "<bound fn " + AS_BOUND_METHOD(value)->method->function->name + ">";
+            }
+            break;
+
+        case ValueType::Native:
+            out += "<native fn " + AS_NATIVE(value)->name + ">";
+            break;
+
+        case ValueType::Thread:
+            out += "<thread>";
+            break;
+
+        case ValueType::Channel:
+            out += "<channel>";
+            break;
+
+        case ValueType::Coroutine:
+            out += "<coroutine " + AS_COROUTINE(value)->closure->function->name + ">";
+            break;
+
+        case ValueType::File:
+            out += "<file " + AS_FILE(value)->path + ">";
+            break;
+
+        case ValueType::MappedFile:
+            out += "<mapped file " + AS_MAPPED_FILE(value)->path + ">";
+            break;
+
+        case ValueType::List: {
+            ListObj* list = AS_LIST(value).get();
+
+            if (std::find(enclosing.begin(), enclosing.end(), list) != enclosing.end()) {
+                out += "[...]";
+                break;
+            }
+
+            enclosing.push_back(list);
+            out += '[';
+
+            for (size_t index = 0; index < list->items.size(); index++) {
+                if (index > 0) out += ", ";
+                appendValue(out, list->items[index], enclosing, true);
+            }
+
+            out += ']';
+            enclosing.pop_back();
+            break;
+        }
+
+        case ValueType::StringBuilder:
+            out += "<string builder>";
+            break;
+
+        case ValueType::Exception: {
+            ExceptionObj* exception = AS_EXCEPTION(value).get();
+            out += exceptionNames[exception->type];
+            out += ": ";
+            out += exception->msg;
+            break;
+        }
+
+        case ValueType::Module:
+            out += "<module " + AS_MODULE(value)->name + ">";
+            break;
+
+        case ValueType::TypedArray: {
+            TypedArrayObj* array = AS_TYPED_ARRAY(value).get();
+            out += array->typeName();
+            out += '[';
+
+            for (size_t index = 0; index < array->length(); index++) {
+                if (index > 0) out += ", ";
+                formatNumber(out, array->get(index));
+            }
+
+            out += ']';
+            break;
+        }
+
+        case ValueType::Map: {
+            MapObj* map = AS_MAP(value).get();
+
+            if (std::find(enclosing.begin(), enclosing.end(), map) != enclosing.end()) {
+                out += "{...}";
+                break;
+            }
+
+            enclosing.push_back(map);
+            out += '{';
+
+            bool first = true;
+            for (MapObj::Entry &entry : map->entries) {
+                if (entry.removed)
+                    continue;
+
+                if (!first) out += ", ";
+                first = false;
+
+                appendValue(out, entry.key, enclosing, true);
+                out += ": ";
+                appendValue(out, entry.value, enclosing, true);
+            }
+
+            out += '}';
+            enclosing.pop_back();
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+void formatValue(std::string &out, const Value &value) {
+    std::vector<const void*> enclosing;
+    appendValue(out, value, enclosing, false);
+}
+
+// Output
+
+Output::Output() {
+    lineBuffered = isatty(STDOUT_FILENO);
+}
+
+Output::~Output() {
+    flush();
+}
+
+void Output::setSink(OutputSink function, void* data) {
+    flush();
+    sinkFunction = function;
+    sinkUserData = data;
+    lineBuffered = function == nullptr && isatty(STDOUT_FILENO);
+}
+
+void Output::writeLine(const Value &value) {
+    formatValue(buffer, value);
+    buffer += '\n';
+
+    if (lineBuffered || buffer.size() >= OUTPUT_FLUSH_SIZE)
+        flush();
+}
+
+void Output::flush() {
+    if (buffer.empty())
+        return;
+
+    if (sinkFunction != nullptr) {
+        sinkFunction(sinkUserData, buffer.data(), buffer.size());
+    } else {
+        fwrite(buffer.data(), 1, buffer.size(), stdout);
+        fflush(stdout);
+    }
+
+    buffer.clear();
+}
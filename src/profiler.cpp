@@ -0,0 +1,159 @@
+#include <fstream>
+#include <unordered_map>
+#include "profiler.h"
+#include "interpreter.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+    #if !defined(EMSCRIPTEN)
+        #define PROFILER_SUPPORTED
+        #include <pthread.h>
+        #include <signal.h>
+        #include <sys/time.h>
+    #endif
+#endif
+
+static Profiler* activeProfiler = nullptr;
+
+Profiler::Profiler(Interpreter* interpreter, int intervalMicroseconds, int maxFrames) 
+    : interpreter(interpreter), intervalMicroseconds(intervalMicroseconds), maxFrames(maxFrames) {
+    maxSamples = maxFrames / 4;
+}
+
+Profiler::~Profiler() {
+    stop();
+}
+
+bool Profiler::start() {
+#ifdef PROFILER_SUPPORTED
+    if (running || activeProfiler != nullptr)
+        return false;
+
+    frameBuffer = std::make_unique<ProfileFrame[]>(maxFrames);
+    sampleStarts = std::make_unique<int[]>(maxSamples + 1);
+    framesUsed = 0;
+    samples = 0;
+    dropped = 0;
+
+    activeProfiler = this;
+
+    struct sigaction action = {};
+    action.sa_handler = &Profiler::handleSignal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, nullptr);
+
+    struct itimerval timer = {};
+    timer.it_interval.tv_sec = intervalMicroseconds / 1000000;
+    timer.it_interval.tv_usec = intervalMicroseconds % 1000000;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_PROF, &timer, nullptr);
+
+    running = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Profiler::stop() {
+#ifdef PROFILER_SUPPORTED
+    if (!running)
+        return;
+
+    struct itimerval timer = {};
+    setitimer(ITIMER_PROF, &timer, nullptr);
+    signal(SIGPROF, SIG_IGN);
+
+    activeProfiler = nullptr;
+    running = false;
+#endif
+}
+
+void Profiler::handleSignal(int) {
+    if (activeProfiler != nullptr)
+        activeProfiler->takeSample();
+}
+
+// Runs inside the signal handler: no allocation, no locks, no reference counting
+void Profiler::takeSample() {
+    int frameCount = interpreter->frameCount;
+
+    if (frameCount <= 0)
+        return;
+
+    if (samples >= maxSamples || framesUsed + frameCount > maxFrames) {
+        dropped = dropped + 1;
+        return;
+    }
+
+    int start = framesUsed;
+
+    for (int index = 0; index < frameCount; index++) {
+        CallFrame &frame = interpreter->frames[index];
+        FunctionObj* function = frame.closure->function.get();
+
+        frameBuffer[start + index] = ProfileFrame{function, (int) (frame.ip - function->chunk.bytecode.data()) - 1};
+    }
+
+    sampleStarts[samples] = start;
+    framesUsed = start + frameCount;
+    samples = samples + 1;
+    sampleStarts[samples] = framesUsed;
+}
+
+// Writes one line per distinct stack, "script:12;fib:3;fib:3 57", as read by flamegraph.pl
+bool Profiler::writeCollapsed(const std::string &path) {
+    std::ofstream file(path);
+
+    if (!file.is_open())
+        return false;
+
+    std::unordered_map<std::string, int> stackCounts;
+    std::vector<std::string> order;
+
+    for (int sample = 0; sample < samples; sample++) {
+        std::string stack;
+
+        for (int index = sampleStarts[sample]; index < sampleStarts[sample + 1]; index++) {
+            ProfileFrame &frame = frameBuffer[index];
+
+            if (index != sampleStarts[sample])
+                stack += ';';
+
+            stack += frame.function->name.size() ? frame.function->name : "script";
+            stack += ':';
+            stack += std::to_string(frame.function->chunk.getLineNumber(frame.offset));
+        }
+
+        if (stackCounts[stack]++ == 0)
+            order.push_back(stack);
+    }
+
+    for (auto &stack : order)
+        file << stack << ' ' << stackCounts[stack] << '\n';
+
+    return true;
+}
+
+ProfilerSignalBlock::ProfilerSignalBlock() {
+#ifdef PROFILER_SUPPORTED
+    sigset_t profiling, previous;
+    sigemptyset(&profiling);
+    sigaddset(&profiling, SIGPROF);
+
+    if (pthread_sigmask(SIG_BLOCK, &profiling, &previous) == 0)
+        unblock = !sigismember(&previous, SIGPROF);
+#endif
+}
+
+ProfilerSignalBlock::~ProfilerSignalBlock() {
+#ifdef PROFILER_SUPPORTED
+    if (!unblock)
+        return;
+
+    sigset_t profiling;
+    sigemptyset(&profiling);
+    sigaddset(&profiling, SIGPROF);
+    pthread_sigmask(SIG_UNBLOCK, &profiling, nullptr);
+#endif
+}
@@ -1,7 +1,268 @@
+#include <array>
+#include <bit>
 #include "common.h"
 #include "scanner.h"
 #include "jakelang.h"
 
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+// Character Classes
+
+enum CharClass : u8 {
+    CharDigit = 1 << 0,
+    CharAlpha = 1 << 1,  // Letters and '_'
+    CharSpace = 1 << 2,  // ' ', '\t', '\r' and '\n'
+};
+
+static constexpr std::array<u8, 256> makeCharClasses() {
+    std::array<u8, 256> classes = {};
+
+    for (int c = '0'; c <= '9'; c++) classes[c] |= CharDigit;
+    for (int c = 'a'; c <= 'z'; c++) classes[c] |= CharAlpha;
+    for (int c = 'A'; c <= 'Z'; c++) classes[c] |= CharAlpha;
+    classes['_'] |= CharAlpha;
+
+    classes[' '] |= CharSpace;
+    classes['\t'] |= CharSpace;
+    classes['\r'] |= CharSpace;
+    classes['\n'] |= CharSpace;
+
+    return classes;
+}
+
+static constexpr std::array<u8, 256> charClasses = makeCharClasses();
+
+static inline bool isDigitChar(char c) {
+    return charClasses[(u8) c] & CharDigit;
+}
+
+static inline bool isAlphaChar(char c) {
+    return charClasses[(u8) c] & CharAlpha;
+}
+
+static inline bool isIdentifierChar(char c) {
+    return charClasses[(u8) c] & (CharAlpha | CharDigit);
+}
+
+static inline bool isSpaceChar(char c) {
+    return charClasses[(u8) c] & CharSpace;
+}
+
+// Keywords
+
+struct Keyword {
+    std::string_view name;
+    TokenType type;
+};
+
+static constexpr Keyword keywords[] = {
+    {"and", TokenType::And},
+    {"or", TokenType::Or},
+    {"if", TokenType::If},
+    {"else", TokenType::Else},
+    {"while", TokenType::While},
+    {"for", TokenType::For},
+    {"true", TokenType::True},
+    {"false", TokenType::False},
+    {"none", TokenType::None},
+    {"return", TokenType::Return},
+    {"print", TokenType::Print},
+    {"var", TokenType::Var},
+    {"func", TokenType::Func},
+    {"class", TokenType::Class},
+    {"this", TokenType::This},
+    {"super", TokenType::Super},
+    {"yield", TokenType::Yield},
+    {"import", TokenType::Import},
+    {"try", TokenType::Try},
+    {"catch", TokenType::Catch},
+    {"throw", TokenType::Throw},
+};
+
+#define KEYWORD_TABLE_SIZE 64
+
+// Perfect hash over the keyword set, checked for collisions at compile time below
+static constexpr u32 keywordHash(std::string_view str) {
+    return ((u8) str.front() + (u8) str.back() * 52 + (u32) str.size()) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+static constexpr std::array<Keyword, KEYWORD_TABLE_SIZE> makeKeywordTable() {
+    std::array<Keyword, KEYWORD_TABLE_SIZE> table = {};
+
+    for (auto &slot : table) 
+        slot = Keyword{"", TokenType::Identifier};
+
+    for (const Keyword &keyword : keywords)
+        table[keywordHash(keyword.name)] = keyword;
+
+    return table;
+}
+
+static constexpr bool keywordHashIsPerfect() {
+    std::array<bool, KEYWORD_TABLE_SIZE> used = {};
+
+    for (const Keyword &keyword : keywords) {
+        if (used[keywordHash(keyword.name)]) return false;
+        used[keywordHash(keyword.name)] = true;
+    }
+
+    return true;
+}
+
+static_assert(keywordHashIsPerfect(), "Keyword hash has collisions, adjust keywordHash");
+
+static constexpr std::array<Keyword, KEYWORD_TABLE_SIZE> keywordTable = makeKeywordTable();
+
+static constexpr size_t findKeywordMinLength() {
+    size_t length = SIZE_MAX;
+    for (const Keyword &keyword : keywords) length = std::min(length, keyword.name.size());
+    return length;
+}
+
+static constexpr size_t findKeywordMaxLength() {
+    size_t length = 0;
+    for (const Keyword &keyword : keywords) length = std::max(length, keyword.name.size());
+    return length;
+}
+
+static constexpr size_t keywordMinLength = findKeywordMinLength();
+static constexpr size_t keywordMaxLength = findKeywordMaxLength();
+
+// Vectorized Scanning
+
+#if defined(__AVX2__)
+
+#define SIMD_WIDTH 32
+#define SIMD_FULL_MASK 0xffffffffu
+
+typedef __m256i SimdVec;
+
+static inline SimdVec simdLoad(const char* ptr) { return _mm256_loadu_si256((const __m256i*) ptr); }
+static inline SimdVec simdSplat(char c) { return _mm256_set1_epi8(c); }
+static inline SimdVec simdEqual(SimdVec a, SimdVec b) { return _mm256_cmpeq_epi8(a, b); }
+static inline SimdVec simdGreater(SimdVec a, SimdVec b) { return _mm256_cmpgt_epi8(a, b); }
+static inline SimdVec simdOr(SimdVec a, SimdVec b) { return _mm256_or_si256(a, b); }
+static inline SimdVec simdAnd(SimdVec a, SimdVec b) { return _mm256_and_si256(a, b); }
+static inline u32 simdMask(SimdVec v) { return (u32) _mm256_movemask_epi8(v); }
+
+#elif defined(__SSE2__)
+
+#define SIMD_WIDTH 16
+#define SIMD_FULL_MASK 0xffffu
+
+typedef __m128i SimdVec;
+
+static inline SimdVec simdLoad(const char* ptr) { return _mm_loadu_si128((const __m128i*) ptr); }
+static inline SimdVec simdSplat(char c) { return _mm_set1_epi8(c); }
+static inline SimdVec simdEqual(SimdVec a, SimdVec b) { return _mm_cmpeq_epi8(a, b); }
+static inline SimdVec simdGreater(SimdVec a, SimdVec b) { return _mm_cmpgt_epi8(a, b); }
+static inline SimdVec simdOr(SimdVec a, SimdVec b) { return _mm_or_si128(a, b); }
+static inline SimdVec simdAnd(SimdVec a, SimdVec b) { return _mm_and_si128(a, b); }
+static inline u32 simdMask(SimdVec v) { return (u32) _mm_movemask_epi8(v); }
+
+#endif
+
+// Each helper returns the first character in [ptr, end) that stops the run, or end.
+// The vector loops only run while a whole block fits before the null terminator.
+
+static const char* skipSpaces(const char* ptr, const char* end, int &lineNumber) {
+#ifdef SIMD_WIDTH
+    while (end - ptr >= SIMD_WIDTH) {
+        SimdVec chunk = simdLoad(ptr);
+        SimdVec newlines = simdEqual(chunk, simdSplat('\n'));
+        SimdVec spaces = simdOr(
+            simdOr(simdEqual(chunk, simdSplat(' ')), simdEqual(chunk, simdSplat('\t'))),
+            simdOr(simdEqual(chunk, simdSplat('\r')), newlines)
+        );
+
+        u32 stop = ~simdMask(spaces) & SIMD_FULL_MASK;
+        u32 newlineMask = simdMask(newlines);
+
+        if (!stop) {
+            lineNumber += std::popcount(newlineMask);
+            ptr += SIMD_WIDTH;
+            continue;
+        }
+
+        int offset = std::countr_zero(stop);
+        lineNumber += std::popcount(newlineMask & ((1u << offset) - 1));
+        return ptr + offset;
+    }
+#endif
+
+    while (ptr < end && isSpaceChar(*ptr)) {
+        lineNumber += *ptr == '\n';
+        ptr++;
+    }
+
+    return ptr;
+}
+
+static const char* skipIdentifierChars(const char* ptr, const char* end) {
+#ifdef SIMD_WIDTH
+    while (end - ptr >= SIMD_WIDTH) {
+        SimdVec chunk = simdLoad(ptr);
+        SimdVec lower = simdOr(chunk, simdSplat(0x20));
+
+        SimdVec alpha = simdAnd(simdGreater(lower, simdSplat('a' - 1)), simdGreater(simdSplat('z' + 1), lower));
+        SimdVec digit = simdAnd(simdGreater(chunk, simdSplat('0' - 1)), simdGreater(simdSplat('9' + 1), chunk));
+        SimdVec underscore = simdEqual(chunk, simdSplat('_'));
+
+        u32 stop = ~simdMask(simdOr(simdOr(alpha, digit), underscore)) & SIMD_FULL_MASK;
+
+        if (stop)
+            return ptr + std::countr_zero(stop);
+
+        ptr += SIMD_WIDTH;
+    }
+#endif
+
+    while (ptr < end && isIdentifierChar(*ptr)) ptr++;
+
+    return ptr;
+}
+
+static const char* findLineEnd(const char* ptr, const char* end) {
+#ifdef SIMD_WIDTH
+    while (end - ptr >= SIMD_WIDTH) {
+        u32 stop = simdMask(simdEqual(simdLoad(ptr), simdSplat('\n')));
+
+        if (stop)
+            return ptr + std::countr_zero(stop);
+
+        ptr += SIMD_WIDTH;
+    }
+#endif
+
+    while (ptr < end && *ptr != '\n') ptr++;
+
+    return ptr;
+}
+
+static const char* findStringEnd(const char* ptr, const char* end, char quote) {
+#ifdef SIMD_WIDTH
+    while (end - ptr >= SIMD_WIDTH) {
+        SimdVec chunk = simdLoad(ptr);
+        u32 stop = simdMask(simdOr(simdEqual(chunk, simdSplat(quote)), simdEqual(chunk, simdSplat('\n'))));
+
+        if (stop)
+            return ptr + std::countr_zero(stop);
+
+        ptr += SIMD_WIDTH;
+    }
+#endif
+
+    while (ptr < end && *ptr != quote && *ptr != '\n') ptr++;
+
+    return ptr;
+}
+
+// Scanner
+
 bool identifiersEqual(Token* a, Token* b) {
     return a->source == b->source;
 }
@@ -10,6 +271,12 @@ Scanner::Scanner(const char* source) : source(source), handledError(false) {
     lineNumber = 1;
     current = source;
     start = source;
+    end = source + strlen(source);
+}
+
+void Scanner::seek(const char* position, int line) {
+    start = current = position;
+    lineNumber = line;
 }
 
 char Scanner::advance() {
@@ -43,29 +310,15 @@ bool Scanner::match(char expected) {
 
 void Scanner::skipWhiteSpace() {
     for (;;) {
-        switch (peek()) {
-            case '\r':
-            case '\t':
-            case ' ':
-                advance();
-                break;
-            case '\n':
-                lineNumber++;
-                advance();
-                break;
-            
-            case '/':
-                if (peekNext() == '/') {
-                    while (peek() != '\n' and !isAtEnd()) advance();
-                } else {
-                    return;
-                }
+        if (isSpaceChar(peek()))
+            current = skipSpaces(current, end, lineNumber);
 
-                break;
-
-            default:
-                return;
+        if (peek() == '/' && peekNext() == '/') {
+            current = findLineEnd(current + 2, end);
+            continue;
         }
+
+        return;
     }
 }
 
@@ -74,11 +327,11 @@ Token Scanner::makeToken(TokenType type) {
 }
 
 Token Scanner::scanNumber() {
-    while (isdigit(peek())) advance();
+    while (isDigitChar(peek())) advance();
 
     if (peek() == '.') {
         advance();
-        while (isdigit(peek())) advance();
+        while (isDigitChar(peek())) advance();
     }
 
     return makeToken(TokenType::Number);
@@ -87,23 +340,21 @@ Token Scanner::scanNumber() {
 Token Scanner::scanString() {
     char startingChar = current[-1];
 
-    while (peek() != startingChar) {
-        if (peek() == '\n' || isAtEnd()) {
-            printError(ExceptionType::SyntaxError, "String literal does not end", lineNumber, "");
-            handledError = true;
-            return makeToken(TokenType::Error);
-        }
+    current = findStringEnd(current, end, startingChar);
 
-        advance();
+    if (peek() != startingChar) {
+        if (reportErrors)
+            printError(ExceptionType::SyntaxError, "String literal does not end", lineNumber, "");
+        handledError = true;
+        return makeToken(TokenType::Error);
     }
-        
 
     advance();
     return makeToken(TokenType::String);
 }
 
 Token Scanner::scanIdentifer() {
-    while (isalpha(peek()) || isdigit(peek()) || peek() == '_') advance();
+    current = skipIdentifierChars(current, end);
     return makeToken(getIdentiferType());
 }
 
@@ -117,10 +368,10 @@ Token Scanner::scanToken() {
 
     char c = advance();
 
-    if (isdigit(c))
+    if (isDigitChar(c))
         return scanNumber();
 
-    if (isalpha(c) || c == '_')
+    if (isAlphaChar(c))
         return scanIdentifer();
 
     if (c == '\"' || c == '\'')
@@ -131,8 +382,11 @@ Token Scanner::scanToken() {
         case ')': return makeToken(TokenType::RightParen);
         case '{': return makeToken(TokenType::LeftBrace);
         case '}': return makeToken(TokenType::RightBrace);
+        case '[': return makeToken(TokenType::LeftBracket);
+        case ']': return makeToken(TokenType::RightBracket);
         case ',': return makeToken(TokenType::Comma);
         case ';': return makeToken(TokenType::Semicolon);
+        case ':': return makeToken(TokenType::Colon);
 
         case '+':
             return makeToken(match('=') ? TokenType::PlusEqual : TokenType::Plus);
@@ -152,7 +406,7 @@ Token Scanner::scanToken() {
             return makeToken(match('=') ? TokenType::LessEqual : TokenType::Less);
             
         case '.':
-            if (isdigit(peek()))
+            if (isDigitChar(peek()))
                 return scanNumber();
             return makeToken(TokenType::Dot);
         
@@ -162,43 +416,16 @@ Token Scanner::scanToken() {
 };
 
 TokenType Scanner::getIdentiferType() {
-    std::string_view str = std::string_view(start, (int) (current - start));
-
-    if (str == "if") {
-        return TokenType::If;
-    } else if (str == "and") {
-        return TokenType::And;
-    } else if (str == "or") {
-        return TokenType::Or;
-    } else if (str == "if") {
-        return TokenType::If;
-    } else if (str == "else") {
-        return TokenType::Else;
-    } else if (str == "while") {
-        return TokenType::While;
-    } else if (str == "for") {
-        return TokenType::For;
-    } else if (str == "true") {
-        return TokenType::True;
-    } else if (str == "false") {
-        return TokenType::False;
-    } else if (str == "none") {
-        return TokenType::None;
-    } else if (str == "return") {
-        return TokenType::Return;
-    } else if (str == "print") {
-        return TokenType::Print;
-    } else if (str == "var") {
-        return TokenType::Var;
-    } else if (str == "func") {
-        return TokenType::Func;
-    } else if (str == "class") {
-        return TokenType::Class;
-    } else if (str == "this") {
-        return TokenType::This;
-    } else if (str == "super") {
-        return TokenType::Super;
-    }
+    size_t length = (size_t) (current - start);
+
+    if (length < keywordMinLength || length > keywordMaxLength)
+        return TokenType::Identifier;
+
+    std::string_view str = std::string_view(start, length);
+    const Keyword &keyword = keywordTable[keywordHash(str)];
+
+    if (keyword.name == str)
+        return keyword.type;
 
     return TokenType::Identifier;
 }
@@ -0,0 +1,374 @@
+#include <algorithm>
+#include <cmath>
+#include "typedArray.h"
+
+#if defined(__AVX__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+// Typed array
+
+TypedArrayObj::TypedArrayObj(ElementType elementType, size_t length, HeapAccount* account)
+    : elementType(elementType), float64(AccountedAllocator<double>(account)), int32(AccountedAllocator<i32>(account)) {
+
+    if (elementType == ElementType::Float64)
+        float64.resize(length);
+    else
+        int32.resize(length);
+}
+
+void TypedArrayObj::set(size_t index, double value) {
+    if (elementType == ElementType::Float64)
+        float64[index] = value;
+    else
+        int32[index] = toInt32(value);
+}
+
+// Truncates toward zero, then wraps modulo 2^32 like a C cast from a wider integer would
+i32 toInt32(double value) {
+    if (!std::isfinite(value))
+        return 0;
+
+    double truncated = std::trunc(value);
+
+    if (truncated >= -2147483648.0 && truncated <= 2147483647.0)
+        return (i32) truncated;
+
+    double wrapped = std::fmod(truncated, 4294967296.0);
+    if (wrapped < 0)
+        wrapped += 4294967296.0;
+
+    return (i32) (u32) wrapped;
+}
+
+// Vector helpers
+
+#if defined(__AVX__)
+
+#define F64_LANES 4
+
+typedef __m256d F64Vec;
+
+static inline F64Vec f64Load(const double* ptr) { return _mm256_loadu_pd(ptr); }
+static inline void f64Store(double* ptr, F64Vec v) { _mm256_storeu_pd(ptr, v); }
+static inline F64Vec f64Splat(double x) { return _mm256_set1_pd(x); }
+static inline F64Vec f64Add(F64Vec a, F64Vec b) { return _mm256_add_pd(a, b); }
+static inline F64Vec f64Mul(F64Vec a, F64Vec b) { return _mm256_mul_pd(a, b); }
+static inline F64Vec f64Min(F64Vec a, F64Vec b) { return _mm256_min_pd(a, b); }
+static inline F64Vec f64Max(F64Vec a, F64Vec b) { return _mm256_max_pd(a, b); }
+
+#elif defined(__SSE2__)
+
+#define F64_LANES 2
+
+typedef __m128d F64Vec;
+
+static inline F64Vec f64Load(const double* ptr) { return _mm_loadu_pd(ptr); }
+static inline void f64Store(double* ptr, F64Vec v) { _mm_storeu_pd(ptr, v); }
+static inline F64Vec f64Splat(double x) { return _mm_set1_pd(x); }
+static inline F64Vec f64Add(F64Vec a, F64Vec b) { return _mm_add_pd(a, b); }
+static inline F64Vec f64Mul(F64Vec a, F64Vec b) { return _mm_mul_pd(a, b); }
+static inline F64Vec f64Min(F64Vec a, F64Vec b) { return _mm_min_pd(a, b); }
+static inline F64Vec f64Max(F64Vec a, F64Vec b) { return _mm_max_pd(a, b); }
+
+#endif
+
+// 32 bit lanes need AVX2 for multiply, min and max, SSE2 only covers the prefix sum below
+#if defined(__AVX2__)
+
+#define I32_LANES 8
+
+typedef __m256i I32Vec;
+
+static inline I32Vec i32Load(const i32* ptr) { return _mm256_loadu_si256((const __m256i*) ptr); }
+static inline void i32Store(i32* ptr, I32Vec v) { _mm256_storeu_si256((__m256i*) ptr, v); }
+static inline I32Vec i32Splat(i32 x) { return _mm256_set1_epi32(x); }
+static inline I32Vec i32Add(I32Vec a, I32Vec b) { return _mm256_add_epi32(a, b); }
+static inline I32Vec i32Mul(I32Vec a, I32Vec b) { return _mm256_mullo_epi32(a, b); }
+static inline I32Vec i32Min(I32Vec a, I32Vec b) { return _mm256_min_epi32(a, b); }
+static inline I32Vec i32Max(I32Vec a, I32Vec b) { return _mm256_max_epi32(a, b); }
+
+#endif
+
+// Wrapping integer arithmetic, signed overflow is undefined so it goes through unsigned
+static inline i32 wrapAdd(i32 a, i32 b) { return (i32) ((u32) a + (u32) b); }
+static inline i32 wrapMul(i32 a, i32 b) { return (i32) ((u32) a * (u32) b); }
+
+// Kernels
+
+namespace Kernels {
+
+    void add(const double* a, const double* b, double* out, size_t count) {
+        size_t index = 0;
+
+    #ifdef F64_LANES
+        for (; index + F64_LANES <= count; index += F64_LANES)
+            f64Store(out + index, f64Add(f64Load(a + index), f64Load(b + index)));
+    #endif
+
+        for (; index < count; index++)
+            out[index] = a[index] + b[index];
+    }
+
+    void add(const i32* a, const i32* b, i32* out, size_t count) {
+        size_t index = 0;
+
+    #ifdef I32_LANES
+        for (; index + I32_LANES <= count; index += I32_LANES)
+            i32Store(out + index, i32Add(i32Load(a + index), i32Load(b + index)));
+    #endif
+
+        for (; index < count; index++)
+            out[index] = wrapAdd(a[index], b[index]);
+    }
+
+    void mul(const double* a, const double* b, double* out, size_t count) {
+        size_t index = 0;
+
+    #ifdef F64_LANES
+        for (; index + F64_LANES <= count; index += F64_LANES)
+            f64Store(out + index, f64Mul(f64Load(a + index), f64Load(b + index)));
+    #endif
+
+        for (; index < count; index++)
+            out[index] = a[index] * b[index];
+    }
+
+    void mul(const i32* a, const i32* b, i32* out, size_t count) {
+        size_t index = 0;
+
+    #ifdef I32_LANES
+        for (; index + I32_LANES <= count; index += I32_LANES)
+            i32Store(out + index, i32Mul(i32Load(a + index), i32Load(b + index)));
+    #endif
+
+        for (; index < count; index++)
+            out[index] = wrapMul(a[index], b[index]);
+    }
+
+    void scale(const double* a, double factor, double* out, size_t count) {
+        size_t index = 0;
+
+    #ifdef F64_LANES
+        F64Vec factors = f64Splat(factor);
+        for (; index + F64_LANES <= count; index += F64_LANES)
+            f64Store(out + index, f64Mul(f64Load(a + index), factors));
+    #endif
+
+        for (; index < count; index++)
+            out[index] = a[index] * factor;
+    }
+
+    void scale(const i32* a, i32 factor, i32* out, size_t count) {
+        size_t index = 0;
+
+    #ifdef I32_LANES
+        I32Vec factors = i32Splat(factor);
+        for (; index + I32_LANES <= count; index += I32_LANES)
+            i32Store(out + index, i32Mul(i32Load(a + index), factors));
+    #endif
+
+        for (; index < count; index++)
+            out[index] = wrapMul(a[index], factor);
+    }
+
+    // Four independent accumulators hide the latency of the adds
+    double sum(const double* a, size_t count) {
+        size_t index = 0;
+        double total = 0;
+
+    #ifdef F64_LANES
+        F64Vec sums[4] = {f64Splat(0), f64Splat(0), f64Splat(0), f64Splat(0)};
+
+        for (; index + 4 * F64_LANES <= count; index += 4 * F64_LANES) {
+            for (int lane = 0; lane < 4; lane++)
+                sums[lane] = f64Add(sums[lane], f64Load(a + index + lane * F64_LANES));
+        }
+
+        double lanes[F64_LANES];
+        f64Store(lanes, f64Add(f64Add(sums[0], sums[1]), f64Add(sums[2], sums[3])));
+
+        for (double lane : lanes)
+            total += lane;
+    #endif
+
+        for (; index < count; index++)
+            total += a[index];
+
+        return total;
+    }
+
+    double sum(const i32* a, size_t count) {
+        i64 total = 0;
+
+        for (size_t index = 0; index < count; index++)
+            total += a[index];
+
+        return (double) total;
+    }
+
+    double dot(const double* a, const double* b, size_t count) {
+        size_t index = 0;
+        double total = 0;
+
+    #ifdef F64_LANES
+        F64Vec sums[4] = {f64Splat(0), f64Splat(0), f64Splat(0), f64Splat(0)};
+
+        for (; index + 4 * F64_LANES <= count; index += 4 * F64_LANES) {
+            for (int lane = 0; lane < 4; lane++) {
+                size_t offset = index + lane * F64_LANES;
+                sums[lane] = f64Add(sums[lane], f64Mul(f64Load(a + offset), f64Load(b + offset)));
+            }
+        }
+
+        double lanes[F64_LANES];
+        f64Store(lanes, f64Add(f64Add(sums[0], sums[1]), f64Add(sums[2], sums[3])));
+
+        for (double lane : lanes)
+            total += lane;
+    #endif
+
+        for (; index < count; index++)
+            total += a[index] * b[index];
+
+        return total;
+    }
+
+    double dot(const i32* a, const i32* b, size_t count) {
+        i64 total = 0;
+
+        for (size_t index = 0; index < count; index++)
+            total += (i64) a[index] * b[index];
+
+        return (double) total;
+    }
+
+    double min(const double* a, size_t count) {
+        size_t index = 0;
+        double result = a[0];
+
+    #ifdef F64_LANES
+        if (count >= F64_LANES) {
+            F64Vec lowest = f64Load(a);
+
+            for (index = F64_LANES; index + F64_LANES <= count; index += F64_LANES)
+                lowest = f64Min(lowest, f64Load(a + index));
+
+            double lanes[F64_LANES];
+            f64Store(lanes, lowest);
+            result = *std::min_element(lanes, lanes + F64_LANES);
+        }
+    #endif
+
+        for (; index < count; index++)
+            result = std::min(result, a[index]);
+
+        return result;
+    }
+
+    double min(const i32* a, size_t count) {
+        size_t index = 0;
+        i32 result = a[0];
+
+    #ifdef I32_LANES
+        if (count >= I32_LANES) {
+            I32Vec lowest = i32Load(a);
+
+            for (index = I32_LANES; index + I32_LANES <= count; index += I32_LANES)
+                lowest = i32Min(lowest, i32Load(a + index));
+
+            i32 lanes[I32_LANES];
+            i32Store(lanes, lowest);
+            result = *std::min_element(lanes, lanes + I32_LANES);
+        }
+    #endif
+
+        for (; index < count; index++)
+            result = std::min(result, a[index]);
+
+        return result;
+    }
+
+    double max(const double* a, size_t count) {
+        size_t index = 0;
+        double result = a[0];
+
+    #ifdef F64_LANES
+        if (count >= F64_LANES) {
+            F64Vec highest = f64Load(a);
+
+            for (index = F64_LANES; index + F64_LANES <= count; index += F64_LANES)
+                highest = f64Max(highest, f64Load(a + index));
+
+            double lanes[F64_LANES];
+            f64Store(lanes, highest);
+            result = *std::max_element(lanes, lanes + F64_LANES);
+        }
+    #endif
+
+        for (; index < count; index++)
+            result = std::max(result, a[index]);
+
+        return result;
+    }
+
+    double max(const i32* a, size_t count) {
+        size_t index = 0;
+        i32 result = a[0];
+
+    #ifdef I32_LANES
+        if (count >= I32_LANES) {
+            I32Vec highest = i32Load(a);
+
+            for (index = I32_LANES; index + I32_LANES <= count; index += I32_LANES)
+                highest = i32Max(highest, i32Load(a + index));
+
+            i32 lanes[I32_LANES];
+            i32Store(lanes, highest);
+            result = *std::max_element(lanes, lanes + I32_LANES);
+        }
+    #endif
+
+        for (; index < count; index++)
+            result = std::max(result, a[index]);
+
+        return result;
+    }
+
+    // A vectorized floating point scan would change the rounding of every element, this stays
+    // a sequential loop
+    void prefixSum(const double* a, double* out, size_t count) {
+        double total = 0;
+
+        for (size_t index = 0; index < count; index++)
+            out[index] = total += a[index];
+    }
+
+    // Scans four lanes at a time with two shifted adds, then adds the carry from the last block
+    void prefixSum(const i32* a, i32* out, size_t count) {
+        size_t index = 0;
+        i32 total = 0;
+
+    #if defined(__SSE2__)
+        __m128i carry = _mm_setzero_si128();
+
+        for (; index + 4 <= count; index += 4) {
+            __m128i x = _mm_loadu_si128((const __m128i*) (a + index));
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+            x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+            x = _mm_add_epi32(x, carry);
+            _mm_storeu_si128((__m128i*) (out + index), x);
+            carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+        }
+
+        if (index > 0)
+            total = out[index - 1];
+    #endif
+
+        for (; index < count; index++)
+            out[index] = total = wrapAdd(total, a[index]);
+    }
+
+}
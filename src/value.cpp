@@ -1,4 +1,5 @@
 #include "value.h"
+#include "compiler.h"
 
 // Chunk
 
@@ -22,11 +23,50 @@ int Chunk::addConstant(Value value) {
 }
 
 int Chunk::getLineNumber(int bytecodeIndex) {
+    int lineNumber = 0;
+
     for (auto &[line, index] : lineNumbers) {
-        if (bytecodeIndex >= index)
-            return line;
+        if (index > bytecodeIndex)
+            break;
+        lineNumber = line;
     }
-    return 0;
+
+    return lineNumber;
+}
+
+// Function
+
+bool FunctionObj::freeze() {
+    if (frozen)
+        return true;
+
+    // Compiled here so other threads never race to compile the same stub. A body that doesn't
+    // compile can't be shared, the syntax error is raised if it's called on this thread.
+    std::string error;
+    if (lazy != nullptr && !compileLazyFunction(this, error))
+        return false;
+
+    for (Value &constant : chunk.constants) {
+        switch (constant.type()) {
+            case ValueType::None:
+            case ValueType::Number:
+            case ValueType::Boolean:
+            case ValueType::String:
+                break;
+
+            case ValueType::Function:
+                if (!AS_FUNCTION(constant)->freeze())
+                    return false;
+                break;
+
+            default:
+                return false;
+        }
+    }
+
+    frozen = true;
+
+    return true;
 }
 
 // Closure
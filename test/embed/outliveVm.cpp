@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <memory>
+#include "jake.h"
+
+// Values a host got from a VM stay usable after the VM is gone. Whatever was charged to the
+// VM's heap is released when the host drops it, run under ASan to see it touches nothing freed.
+
+static const char* source = R"(
+var names = ["first", "second"];
+var table = {"key": [1, 2, 3]};
+
+func longText(count) {
+    var text = "x";
+    for (var i = 0; i < count; i = i + 1) text = text + text;
+    return text;
+}
+
+func counter() {
+    var count = 0;
+    func next() {
+        count = count + 1;
+        return count;
+    }
+    return next;
+}
+
+func numbers() {
+    yield 1;
+    yield 2;
+}
+
+var generator = coroutine(numbers);
+)";
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+    if (!condition) {
+        printf("FAIL %s\n", what);
+        failures++;
+    }
+}
+
+int main() {
+    Value names;
+    Value table;
+    Value text;
+    Value next;
+    Value generator;
+
+    {
+        jake::VM vm;
+        vm.setLimits(jake::Limits{0, 1 << 24});
+
+        if (vm.run(source) != jake::Result::Success) {
+            printf("[Error] %s\n", vm.error().c_str());
+            return 1;
+        }
+
+        names = vm.get("names");
+        table = vm.get("table");
+        next = vm.get("counter");
+        generator = vm.get("generator");
+
+        check(vm.call(vm.get("longText"), text, 16) == jake::Result::Success, "longText call");
+        check(vm.call(next, next) == jake::Result::Success, "counter call");
+
+        // Suspended, so its stack is allocated and charged
+        Value first;
+        check(vm.call(generator, first) == jake::Result::Success && AS_NUMBER(first) == 1, "coroutine call");
+    }
+
+    check(IS_LIST(names) && AS_LIST(names)->items.size() == 2, "list survives");
+    check(IS_STRING(AS_LIST(names)->items[1]) && AS_STRING(AS_LIST(names)->items[1]) == "second", "list item survives");
+    check(IS_MAP(table), "map survives");
+    check(IS_STRING(text) && AS_STRING(text).size() == 1 << 16, "long string survives");
+    check(IS_CLOSURE(next), "closure survives");
+    check(IS_COROUTINE(generator), "coroutine survives");
+
+    // Growing a value after its VM is gone is charged to the detached account
+    AS_LIST(names)->items.push_back(std::string(1000, 'y'));
+
+    names = NONE_VAL();
+    table = NONE_VAL();
+    text = NONE_VAL();
+    next = NONE_VAL();
+    generator = NONE_VAL();
+
+    if (failures)
+        return 1;
+
+    printf("ok\n");
+    return 0;
+}
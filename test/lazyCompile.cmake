@@ -0,0 +1,39 @@
+# Runs every test script with and without --lazy-compile and fails if the output differs.
+# Lazy compilation only finds syntax errors in a function body when the function is first
+# called, so scripts the eager compiler rejects are skipped, as are ones that crash or don't
+# finish without it. Timings are left out of the comparison. Run by the lazy_compile test, see
+# CMakeLists.txt.
+file(GLOB_RECURSE scripts "${TEST_DIR}/*.jake")
+set(compared 0)
+set(failed "")
+
+foreach (script ${scripts})
+    # Limit tests need flags of their own, benchmarks take too long
+    if (script MATCHES "/(benchmark|limit)/")
+        continue()
+    endif()
+
+    execute_process(COMMAND "${JAKE}" "${script}" OUTPUT_VARIABLE eager ERROR_VARIABLE eager RESULT_VARIABLE status TIMEOUT 5)
+
+    if (NOT status MATCHES "^[0-9]+$" OR eager MATCHES "SyntaxError")
+        continue()
+    endif()
+
+    execute_process(COMMAND "${JAKE}" --lazy-compile "${script}" OUTPUT_VARIABLE lazy ERROR_VARIABLE lazy TIMEOUT 30)
+
+    string(REGEX REPLACE "Interpreter finished[^\n]*" "" eager "${eager}")
+    string(REGEX REPLACE "Interpreter finished[^\n]*" "" lazy "${lazy}")
+    math(EXPR compared "${compared} + 1")
+
+    if (NOT eager STREQUAL lazy)
+        file(RELATIVE_PATH name "${TEST_DIR}" "${script}")
+        message("${name} differs with --lazy-compile:\n${lazy}\nexpected:\n${eager}")
+        list(APPEND failed "${name}")
+    endif()
+endforeach()
+
+if (failed)
+    message(FATAL_ERROR "Output differs with --lazy-compile for: ${failed}")
+endif()
+
+message("${compared} scripts give the same output with --lazy-compile")